@@ -0,0 +1,373 @@
+#if defined(__linux__)
+#include "AsyncFileIO.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAS_IO_URING 1
+#endif
+#endif
+
+#if defined(HAS_IO_URING)
+
+namespace {
+int ioUringSetup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                 unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit,
+                                    minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void* arg,
+                    unsigned nrArgs) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+unsigned loadAcquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+}  // namespace
+
+// The rings shared with the kernel
+struct AsyncFileIO::Ring {
+    int fd = -1;
+    void* sqMem = MAP_FAILED;
+    size_t sqMemSize = 0;
+    void* cqMem = MAP_FAILED;
+    size_t cqMemSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned entries;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+
+    std::mutex mtx;
+    // Signaled when operations complete, or are submitted while the reaper
+    // is idle
+    std::condition_variable cond;
+    // Operations submitted and not reaped yet. Kept at most "entries", so the
+    // completion queue (twice as big) can't overflow.
+    unsigned inflight = 0;
+    bool stopping = false;
+    // The reaper is waiting for operations to be submitted
+    bool reaperIdle = false;
+    std::vector<Buffer> buffers;
+    bool submitted = false;
+    std::thread reaper;
+
+    // Returns false if io_uring is not available, or too old
+    bool init(unsigned numEntries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = ioUringSetup(numEntries, &p);
+        if (fd < 0)
+            return false;
+        // IORING_OP_READ/WRITE appeared at the same time as this feature
+        if (!(p.features & IORING_FEAT_RW_CUR_POS))
+            return false;
+
+        sqMemSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqMemSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            sqMemSize = cqMemSize = std::max(sqMemSize, cqMemSize);
+        sqMem = mmap(nullptr, sqMemSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMem == MAP_FAILED)
+            return false;
+        if (!single) {
+            cqMem = mmap(nullptr, cqMemSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqMem == MAP_FAILED)
+                return false;
+        }
+        sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+
+        char* sq = static_cast<char*>(sqMem);
+        char* cq = single ? sq : static_cast<char*>(cqMem);
+        entries = p.sq_entries;
+        sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    ~Ring() {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqMem != MAP_FAILED)
+            munmap(cqMem, cqMemSize);
+        if (sqMem != MAP_FAILED)
+            munmap(sqMem, sqMemSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Index of the registered buffer containing the whole operation, or -1
+    int findBuffer(const Op& op) const {
+        for (size_t i = 0; i < buffers.size(); i++) {
+            char* begin = static_cast<char*>(buffers[i].data);
+            char* buf = static_cast<char*>(op.buf);
+            if (buf >= begin && buf + op.size <= begin + buffers[i].size)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    // Fills the next submission queue entry. Assumes mtx is locked.
+    void prepareLocked(Op* op) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.user_data = reinterpret_cast<uint64_t>(op);
+        if (op->code == OpCode::Fsync || op->code == OpCode::Fdatasync) {
+            sqe.opcode = IORING_OP_FSYNC;
+            sqe.fd = op->fd;
+            if (op->code == OpCode::Fdatasync)
+                sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        } else {
+            bool read = op->code == OpCode::Read;
+            int bufIndex = findBuffer(*op);
+            if (bufIndex == -1) {
+                sqe.opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+            } else {
+                sqe.opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                sqe.buf_index = static_cast<uint16_t>(bufIndex);
+            }
+            sqe.fd = op->fd;
+            sqe.off = op->offset;
+            sqe.addr = reinterpret_cast<uint64_t>(op->buf);
+            sqe.len = static_cast<uint32_t>(op->size);
+        }
+        sqArray[index] = index;
+        storeRelease(sqTail, tail + 1);
+        inflight++;
+    }
+
+    // Submits all prepared entries. Assumes mtx is locked.
+    // If the kernel rejects them (other than temporarily), the entries not
+    // submitted yet are removed, and their operations fail with -errno.
+    void enterLocked(unsigned count) {
+        while (count) {
+            int res = ioUringEnter(fd, count, 0, 0);
+            if (res >= 0) {
+                count -= res;
+                if (res && reaperIdle)
+                    cond.notify_all();
+            } else if (errno == EAGAIN || errno == EBUSY) {
+                std::this_thread::yield();
+            } else if (errno != EINTR) {
+                failLocked(count, -errno);
+                return;
+            }
+        }
+    }
+
+    // Removes the last "count" prepared entries, which the kernel didn't
+    // consume, and completes their operations with "res".
+    // Assumes mtx is locked.
+    void failLocked(unsigned count, int res) {
+        unsigned tail = *sqTail - count;
+        for (unsigned i = tail; i != tail + count; i++) {
+            Op* op = reinterpret_cast<Op*>(sqes[i & sqMask].user_data);
+            op->done(res);
+            delete op;
+        }
+        storeRelease(sqTail, tail);
+        inflight -= count;
+        cond.notify_all();
+    }
+
+    void reap() {
+        while (true) {
+            unsigned head = *cqHead;
+            unsigned tail = loadAcquire(cqTail);
+            if (head == tail) {
+                // Only wait in the kernel while operations are in flight, so
+                // there is always a completion to wake us up
+                std::unique_lock<std::mutex> lock(mtx);
+                reaperIdle = true;
+                cond.wait(lock, [this] { return inflight || stopping; });
+                reaperIdle = false;
+                if (stopping && inflight == 0)
+                    break;
+                lock.unlock();
+                ioUringEnter(fd, 0, 1, IORING_ENTER_GETEVENTS);
+                continue;
+            }
+
+            // Locking also makes the ops visible to this thread as far as the
+            // C++ memory model is concerned, and not only through the kernel.
+            // Releasing the slots before reading them is fine, since the
+            // completion queue has room for twice as many.
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                inflight -= tail - head;
+                cond.notify_all();
+            }
+
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = cqes[head & cqMask];
+                Op* op = reinterpret_cast<Op*>(cqe.user_data);
+                op->done(cqe.res);
+                delete op;
+            }
+            storeRelease(cqHead, head);
+        }
+    }
+};
+
+#else
+
+struct AsyncFileIO::Ring {
+    bool init(unsigned) { return false; }
+};
+
+#endif
+
+AsyncFileIO::AsyncFileIO() : AsyncFileIO(Options()) {}
+
+AsyncFileIO::AsyncFileIO(Options opts) {
+    if (!opts.useThreads) {
+        m_ring.reset(new Ring());
+        if (!m_ring->init(std::max(opts.entries, 1u)))
+            m_ring.reset();
+    }
+
+#if defined(HAS_IO_URING)
+    if (m_ring) {
+        m_ring->reaper = std::thread([this] { m_ring->reap(); });
+        return;
+    }
+#endif
+
+    WorkQueue::PoolOptions pool;
+    pool.minThreads = pool.maxThreads = std::max(opts.threads, 1u);
+    m_pool.startPool(pool);
+}
+
+AsyncFileIO::~AsyncFileIO() {
+#if defined(HAS_IO_URING)
+    if (m_ring) {
+        {
+            // The reaper exits once the operations in flight complete
+            std::lock_guard<std::mutex> lock(m_ring->mtx);
+            m_ring->stopping = true;
+            m_ring->cond.notify_all();
+        }
+        m_ring->reaper.join();
+        return;
+    }
+#endif
+    m_pool.stop();
+    m_pool.joinPool();
+}
+
+bool AsyncFileIO::registerBuffers(std::vector<Buffer> buffers) {
+#if defined(HAS_IO_URING)
+    if (!m_ring)
+        return false;
+    std::lock_guard<std::mutex> lock(m_ring->mtx);
+    assert(!m_ring->submitted && m_ring->buffers.empty());
+    std::vector<iovec> iovs;
+    for (auto&& b : buffers)
+        iovs.push_back(iovec{b.data, b.size});
+    if (ioUringRegister(m_ring->fd, IORING_REGISTER_BUFFERS, iovs.data(),
+                        static_cast<unsigned>(iovs.size())) != 0)
+        return false;
+    m_ring->buffers = std::move(buffers);
+    return true;
+#else
+    (void)buffers;
+    return false;
+#endif
+}
+
+void AsyncFileIO::submit(const std::vector<Op*>& ops) {
+#if defined(HAS_IO_URING)
+    if (m_ring) {
+        std::unique_lock<std::mutex> lock(m_ring->mtx);
+        m_ring->submitted = true;
+        unsigned prepared = 0;
+        for (Op* op : ops) {
+            // Submit what we have so far, and wait for room
+            if (m_ring->inflight == m_ring->entries) {
+                m_ring->enterLocked(prepared);
+                prepared = 0;
+                m_ring->cond.wait(lock, [this] {
+                    return m_ring->inflight < m_ring->entries;
+                });
+            }
+            m_ring->prepareLocked(op);
+            prepared++;
+        }
+        m_ring->enterLocked(prepared);
+        return;
+    }
+#endif
+
+    for (Op* op : ops) {
+        m_pool.push([op] {
+            op->done(execute(*op));
+            delete op;
+        });
+    }
+}
+
+int64_t AsyncFileIO::execute(const Op& op) {
+    ssize_t res = 0;
+    do {
+        switch (op.code) {
+        case OpCode::Read:
+            res = pread(op.fd, op.buf, op.size, static_cast<off_t>(op.offset));
+            break;
+        case OpCode::Write:
+            res = pwrite(op.fd, op.buf, op.size, static_cast<off_t>(op.offset));
+            break;
+        case OpCode::Fsync:
+            res = ::fsync(op.fd);
+            break;
+        case OpCode::Fdatasync:
+            res = ::fdatasync(op.fd);
+            break;
+        }
+    } while (res == -1 && errno == EINTR);
+    return res == -1 ? -errno : res;
+}
+
+#endif
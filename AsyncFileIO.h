@@ -0,0 +1,159 @@
+#pragma once
+#if defined(__linux__)
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "WorkQueue.h"
+
+//
+// Asynchronous file I/O, with the completion handlers posted to a Strand (or
+// anything else with a "post" method), so handlers can persist data without
+// blocking a worker for the whole syscall.
+//
+// Uses io_uring if the kernel supports it, with a single internal thread
+// reaping the completions. Otherwise (or if Options::useThreads is set), the
+// operations are executed with blocking calls by an internal pool of threads.
+//
+// Handlers are called with the syscall result: the number of bytes
+// transferred (which can be short, as with pread/pwrite), 0 for fsync, or
+// -errno.
+//
+// The destructor waits for any pending operations to complete, and posts their
+// handlers, so the owners must still be alive at that point.
+//
+class AsyncFileIO {
+private:
+    struct Op;
+
+public:
+    struct Options {
+        // io_uring submission queue size. This also limits the number of
+        // operations in flight. Submitting more blocks until some complete.
+        unsigned entries = 256;
+        // Don't use io_uring, even if the kernel supports it
+        bool useThreads = false;
+        // Number of threads executing the operations, if not using io_uring
+        unsigned threads = 4;
+    };
+
+    // Memory range for "registerBuffers"
+    struct Buffer {
+        void* data;
+        size_t size;
+    };
+
+    // Collects operations, to submit them all with a single syscall, when
+    // "submit" is called or the Batch is destroyed
+    class Batch {
+    public:
+        explicit Batch(AsyncFileIO& io) : m_io(io) {}
+        ~Batch() { submit(); }
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+
+        template <typename Owner, typename H>
+        void readAt(int fd, uint64_t offset, void* buf, size_t size,
+                    Owner& owner, H handler) {
+            m_ops.push_back(makeOp(OpCode::Read, fd, offset, buf, size, owner,
+                                   std::move(handler)));
+        }
+
+        template <typename Owner, typename H>
+        void writeAt(int fd, uint64_t offset, const void* buf, size_t size,
+                     Owner& owner, H handler) {
+            m_ops.push_back(makeOp(OpCode::Write, fd, offset,
+                                   const_cast<void*>(buf), size, owner,
+                                   std::move(handler)));
+        }
+
+        // If "dataOnly" is set, behaves as fdatasync
+        template <typename Owner, typename H>
+        void fsync(int fd, Owner& owner, H handler, bool dataOnly = false) {
+            m_ops.push_back(makeOp(dataOnly ? OpCode::Fdatasync : OpCode::Fsync,
+                                   fd, 0, nullptr, 0, owner,
+                                   std::move(handler)));
+        }
+
+        void submit() {
+            if (m_ops.size())
+                m_io.submit(m_ops);
+            m_ops.clear();
+        }
+
+    private:
+        AsyncFileIO& m_io;
+        std::vector<Op*> m_ops;
+    };
+
+    AsyncFileIO();
+    explicit AsyncFileIO(Options opts);
+    ~AsyncFileIO();
+    AsyncFileIO(const AsyncFileIO&) = delete;
+    AsyncFileIO& operator=(const AsyncFileIO&) = delete;
+
+    // Tells if io_uring is being used
+    bool usingRing() const { return m_ring != nullptr; }
+
+    // Registers buffers with the kernel, so operations within those buffers
+    // don't need to map the memory for every call. Operations on memory
+    // within a registered buffer use it automatically.
+    // Can only be called once, before submitting any operations.
+    // Returns false if not supported, in which case the buffers can still be
+    // used, without the benefit.
+    bool registerBuffers(std::vector<Buffer> buffers);
+
+    // Same as the Batch methods, but submitting the operation right away
+    template <typename Owner, typename H>
+    void readAt(int fd, uint64_t offset, void* buf, size_t size, Owner& owner,
+                H handler) {
+        Batch(*this).readAt(fd, offset, buf, size, owner, std::move(handler));
+    }
+
+    template <typename Owner, typename H>
+    void writeAt(int fd, uint64_t offset, const void* buf, size_t size,
+                 Owner& owner, H handler) {
+        Batch(*this).writeAt(fd, offset, buf, size, owner, std::move(handler));
+    }
+
+    template <typename Owner, typename H>
+    void fsync(int fd, Owner& owner, H handler, bool dataOnly = false) {
+        Batch(*this).fsync(fd, owner, std::move(handler), dataOnly);
+    }
+
+private:
+    enum class OpCode { Read, Write, Fsync, Fdatasync };
+
+    struct Op {
+        OpCode code;
+        int fd;
+        uint64_t offset;
+        void* buf;
+        size_t size;
+        // Posts the handler to its owner
+        std::function<void(int64_t)> done;
+    };
+
+    template <typename Owner, typename H>
+    static Op* makeOp(OpCode code, int fd, uint64_t offset, void* buf,
+                      size_t size, Owner& owner, H handler) {
+        Op* op = new Op{code, fd, offset, buf, size, nullptr};
+        op->done = [&owner, handler](int64_t res) {
+            owner.post([handler, res]() mutable { handler(res); });
+        };
+        return op;
+    }
+
+    // Takes ownership of the ops
+    void submit(const std::vector<Op*>& ops);
+    // Executes the operation with a blocking call
+    static int64_t execute(const Op& op);
+
+    struct Ring;
+    std::unique_ptr<Ring> m_ring;
+    // Executes the operations if not using io_uring
+    WorkQueue m_pool;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include "AsyncFileIO.h"
+#include "Semaphore.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+const int kNumConns = 16;
+const int kRecords = 2000;
+const size_t kRecordSize = 4096;
+// Records written per batch, in Mode::Batched
+const int kBatch = 8;
+// The data is synced every this many records
+const int kSyncEvery = 64;
+
+enum class Mode {
+    // Blocking pwrite/fdatasync inside the strand handlers
+    Sync,
+    // AsyncFileIO, with io_uring if available
+    Async,
+    // AsyncFileIO, with its thread pool
+    AsyncThreads,
+    // AsyncFileIO, submitting batches of writes from registered buffers
+    Batched
+};
+
+const char* modeName(Mode mode) {
+    switch (mode) {
+    case Mode::Sync: return "Sync";
+    case Mode::Async: return "Async";
+    case Mode::AsyncThreads: return "AsyncThreads";
+    case Mode::Batched: return "Batched";
+    }
+    return "";
+}
+
+// Persists a sequence of records to its own file, one write (or batch) at a
+// time, with everything serialized by the connection's strand
+struct Conn {
+    Conn(int n, WorkQueue& wq) : strand(wq) {
+        path = "asyncfile_" + std::to_string(n) + ".tmp";
+        fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        assert(fd != -1);
+    }
+    ~Conn() {
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    void next() {
+        assert(strand.runningInThisThread());
+        if (written == kRecords) {
+            done->notify();
+            return;
+        }
+
+        if (mode == Mode::Sync) {
+            ssize_t res = pwrite(fd, buf, kRecordSize, written * kRecordSize);
+            assert(res == static_cast<ssize_t>(kRecordSize));
+            (void)res;
+            if (++written % kSyncEvery == 0)
+                fdatasync(fd);
+            strand.post([this] { next(); });
+            return;
+        }
+
+        AsyncFileIO::Batch batch(*io);
+        int count = mode == Mode::Batched ? kBatch : 1;
+        for (int i = 0; i < count; i++) {
+            batch.writeAt(fd, (written + i) * kRecordSize, buf + i * kRecordSize,
+                          kRecordSize, strand, [this, count](int64_t res) {
+                              assert(res == static_cast<int64_t>(kRecordSize));
+                              (void)res;
+                              if (++pending == count)
+                                  onWritten(count);
+                          });
+        }
+    }
+
+    void onWritten(int count) {
+        pending = 0;
+        written += count;
+        if (written % kSyncEvery == 0) {
+            io->fsync(fd, strand, [this](int64_t res) {
+                assert(res == 0);
+                (void)res;
+                next();
+            }, true);
+        } else {
+            next();
+        }
+    }
+
+    std::string path;
+    int fd;
+    char* buf = nullptr;
+    int written = 0;
+    int pending = 0;
+    Mode mode = Mode::Sync;
+    AsyncFileIO* io = nullptr;
+    cz::Semaphore* done = nullptr;
+    Strand<WorkQueue> strand;
+};
+
+void runMode(Mode mode) {
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < 4; i++) {
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    }
+
+    AsyncFileIO::Options opts;
+    opts.useThreads = mode == Mode::AsyncThreads;
+    std::unique_ptr<AsyncFileIO> io;
+    if (mode != Mode::Sync)
+        io.reset(new AsyncFileIO(opts));
+
+    std::vector<char> mem(kNumConns * kBatch * kRecordSize, 'x');
+    bool registered = false;
+    if (mode == Mode::Batched)
+        registered = io->registerBuffers({{mem.data(), mem.size()}});
+
+    cz::Semaphore done;
+    std::vector<std::unique_ptr<Conn>> conns;
+    for (int i = 0; i < kNumConns; i++) {
+        conns.push_back(std::make_unique<Conn>(i, workQueue));
+        Conn* c = conns.back().get();
+        c->buf = mem.data() + i * kBatch * kRecordSize;
+        c->mode = mode;
+        c->io = io.get();
+        c->done = &done;
+    }
+
+    auto start = nowMs();
+    for (auto&& c : conns) {
+        Conn* p = c.get();
+        c->strand.post([p] { p->next(); });
+    }
+    for (int i = 0; i < kNumConns; i++)
+        done.wait();
+    auto elapsed = nowMs() - start;
+
+    // How long work items waited for a worker shows how much the workers
+    // were held up by the I/O
+    auto stats = workQueue.stats()[Priority::Normal];
+    double mb = double(kNumConns) * kRecords * kRecordSize / (1024 * 1024);
+    printf("%-12s: %7.2fms, %7.2f MB/s, queue delay avg=%6.3fms max=%6.3fms%s%s\n",
+           modeName(mode), elapsed, mb * 1000 / elapsed, stats.avgDelayMs(),
+           stats.maxDelayMs,
+           io && !io->usingRing() ? " (threads)" : "",
+           registered ? " (registered buffers)" : "");
+
+    io.reset();
+    workQueue.stop();
+    for (auto&& t : workerThreads) {
+        t.join();
+    }
+}
+
+}  // namespace
+
+void asyncFileSample() {
+    printf("%d connections writing %d records of %d bytes, syncing every %d\n",
+           kNumConns, kRecords, static_cast<int>(kRecordSize), kSyncEvery);
+    runMode(Mode::Sync);
+    runMode(Mode::Async);
+    runMode(Mode::AsyncThreads);
+    runMode(Mode::Batched);
+}
+
+#else
+
+void asyncFileSample() {
+    printf("AsyncFileIO is only available on Linux\n");
+}
+
+#endif
@@ -0,0 +1,345 @@
+#pragma once
+#include "Coroutine.h"
+#include "Futex.h"
+#include "Locks.h"
+#include "Priority.h"
+#include "Strand.h"
+#include <assert.h>
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace detail {
+
+// Storage for the result of an AsyncMonitor operation
+template <typename R>
+class AsyncValue {
+public:
+    static_assert(!std::is_reference<R>::value,
+                  "Returning references to the protected data is not safe");
+
+    ~AsyncValue() {
+        reset();
+    }
+
+    template <typename F, typename T>
+    void set(F& f, T& t) {
+        new (&m_storage) R(f(t));
+        m_set = true;
+    }
+
+    R take() {
+        return std::move(*reinterpret_cast<R*>(&m_storage));
+    }
+
+    void reset() {
+        if (m_set)
+            reinterpret_cast<R*>(&m_storage)->~R();
+        m_set = false;
+    }
+
+private:
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type m_storage;
+    bool m_set = false;
+};
+
+template <>
+class AsyncValue<void> {
+public:
+    template <typename F, typename T>
+    void set(F& f, T& t) {
+        f(t);
+    }
+    void take() {}
+    void reset() {}
+};
+
+// State shared by the strand handler producing a result, and the AsyncResult
+// consuming it. Recycled through AsyncStatePool, so in the steady state
+// "apply" doesn't allocate one.
+template <typename R>
+struct AsyncState {
+    enum : uint32_t {
+        Pending,
+        Ready,
+        // A continuation is set, for the producer to execute
+        Waiting,
+        // The consumer is (about to be) sleeping in "wait"
+        Blocked
+    };
+
+    // Executed by the producer, once the result (or exception) is stored
+    void publish() {
+        uint32_t prev = status.exchange(Ready, std::memory_order_acq_rel);
+        if (prev == Waiting) {
+            std::function<void()> next = std::move(continuation);
+            continuation = nullptr;
+            next();
+        } else if (prev == Blocked) {
+            futexWakeAll(status);
+        }
+    }
+
+    std::atomic<uint32_t> status{Pending};
+    // The producer and the consumer hold a reference each
+    std::atomic<unsigned> refs{2};
+    AsyncValue<R> value;
+    std::exception_ptr error;
+    std::function<void()> continuation;
+    // Pushes resumed coroutines to the monitor's Processor
+    void (*resumeOn)(void* proc, std::function<void()> fn,
+                     Priority prio) = nullptr;
+    void* proc = nullptr;
+    Priority prio = Priority::Normal;
+    // Next free state, in the pool
+    AsyncState* next = nullptr;
+};
+
+// Free list of states, shared by all the monitors producing an "R"
+template <typename R>
+class AsyncStatePool {
+public:
+    ~AsyncStatePool() {
+        while (m_free) {
+            AsyncState<R>* s = m_free;
+            m_free = s->next;
+            delete s;
+        }
+    }
+
+    static AsyncStatePool& instance() {
+        static AsyncStatePool pool;
+        return pool;
+    }
+
+    AsyncState<R>* acquire() {
+        {
+            std::lock_guard<SpinLock> hold(m_lock);
+            if (AsyncState<R>* s = m_free) {
+                m_free = s->next;
+                return s;
+            }
+        }
+        return new AsyncState<R>();
+    }
+
+    // Drops a reference, and recycles the state if it was the last one
+    void release(AsyncState<R>* s) {
+        if (s->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        s->value.reset();
+        s->error = nullptr;
+        s->status.store(AsyncState<R>::Pending, std::memory_order_relaxed);
+        s->refs.store(2, std::memory_order_relaxed);
+        std::lock_guard<SpinLock> hold(m_lock);
+        s->next = m_free;
+        m_free = s;
+    }
+
+private:
+    SpinLock m_lock;
+    AsyncState<R>* m_free = nullptr;
+};
+
+}  // namespace detail
+
+//
+// Lightweight future for the result of AsyncMonitor::apply.
+// "get" blocks until the result is ready, so it's meant for threads outside
+// the Processor. Workers should use the callback form of "apply" instead, or
+// "co_await" the result from a coroutine, which resumes in the monitor's
+// Processor.
+// Calling "get" from the monitor's own strand deadlocks.
+//
+template <typename R>
+class AsyncResult {
+public:
+    AsyncResult() {}
+    explicit AsyncResult(detail::AsyncState<R>* state) : m_state(state) {}
+    AsyncResult(AsyncResult&& other) : m_state(other.m_state) {
+        other.m_state = nullptr;
+    }
+    AsyncResult& operator=(AsyncResult&& other) {
+        std::swap(m_state, other.m_state);
+        return *this;
+    }
+    ~AsyncResult() {
+        if (m_state)
+            detail::AsyncStatePool<R>::instance().release(m_state);
+    }
+
+    AsyncResult(const AsyncResult&) = delete;
+    AsyncResult& operator=(const AsyncResult&) = delete;
+
+    bool valid() const {
+        return m_state != nullptr;
+    }
+
+    bool ready() const {
+        assert(m_state);
+        return m_state->status.load(std::memory_order_acquire) ==
+               detail::AsyncState<R>::Ready;
+    }
+
+    // Blocks until the result is ready
+    void wait() {
+        assert(m_state);
+        using State = detail::AsyncState<R>;
+        uint32_t expected = State::Pending;
+        if (!m_state->status.compare_exchange_strong(
+                expected, State::Blocked, std::memory_order_acq_rel))
+            return;
+        while (m_state->status.load(std::memory_order_acquire) != State::Ready)
+            futexWait(m_state->status, State::Blocked);
+    }
+
+    // Waits for the result and returns it, or rethrows the operation's
+    // exception. Can only be called once.
+    R get() {
+        wait();
+        return take();
+    }
+
+#if CZ_HAS_COROUTINES
+    bool await_ready() const noexcept {
+        return ready();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        using State = detail::AsyncState<R>;
+        detail::AsyncState<R>* s = m_state;
+        s->continuation = [s, h] {
+            s->resumeOn(s->proc, [h] { h.resume(); }, s->prio);
+        };
+        uint32_t expected = State::Pending;
+        if (s->status.compare_exchange_strong(expected, State::Waiting,
+                                              std::memory_order_acq_rel))
+            return true;
+        // Already finished, so carry on without suspending
+        s->continuation = nullptr;
+        return false;
+    }
+
+    R await_resume() {
+        return take();
+    }
+#endif
+
+private:
+    R take() {
+        if (m_state->error)
+            std::rethrow_exception(m_state->error);
+        return m_state->value.take();
+    }
+
+    detail::AsyncState<R>* m_state = nullptr;
+};
+
+//
+// Non-blocking counterpart to Monitor, for code running in a Processor.
+// Instead of blocking the calling worker until the lock is free (which wastes
+// the worker, and can cause priority inversion), operations are enqueued in
+// an internal Strand, and execute serialized on the object:
+//
+//	AsyncMonitor<Session, WorkQueue> session(workQueue);
+//	// Callback, executed in the strand right after the operation
+//	session.apply([](Session& s) { return s.bytes(); },
+//	              [](size_t bytes) { ... });
+//	// Future
+//	auto res = session.apply([](Session& s) { return s.bytes(); });
+//	size_t bytes = res.get();
+//	// Coroutine, resumed from the Processor
+//	size_t bytes = co_await session.apply([](Session& s) {...});
+//
+// The futures' state is pooled, so in the steady state "apply" only costs
+// what posting to the strand does. If an operation throws, the future rethrows
+// the exception, while with a callback it propagates out of the strand's
+// handler as usual.
+// As with Strand, the monitor must outlive any work pending in the Processor.
+//
+template <class T, class Processor, class Lock = std::mutex>
+class AsyncMonitor {
+public:
+    using Type = T;
+    AsyncMonitor(Processor& proc) : m_proc(proc), m_strand(proc) {}
+
+    // Any extra arguments are passed to the strand's lock constructor
+    template <typename... LockArgs>
+    AsyncMonitor(Processor& proc, T t_, LockArgs&&... lockArgs)
+        : m_t(std::move(t_)),
+          m_proc(proc),
+          m_strand(proc, std::forward<LockArgs>(lockArgs)...) {}
+
+    AsyncMonitor(const AsyncMonitor&) = delete;
+    AsyncMonitor& operator=(const AsyncMonitor&) = delete;
+
+    // Enqueues "f(T&)", and returns a future for its result
+    template <typename F>
+    auto apply(F f, Priority prio = Priority::Normal)
+        -> AsyncResult<decltype(f(std::declval<T&>()))> {
+        using R = decltype(f(std::declval<T&>()));
+        using State = detail::AsyncState<R>;
+        State* s = detail::AsyncStatePool<R>::instance().acquire();
+        s->resumeOn = &resumeOn;
+        s->proc = &m_proc;
+        s->prio = prio;
+        m_strand.post(
+            [this, f, s]() mutable {
+                try {
+                    s->value.set(f, m_t);
+                } catch (...) {
+                    s->error = std::current_exception();
+                }
+                s->publish();
+                detail::AsyncStatePool<R>::instance().release(s);
+            },
+            prio);
+        return AsyncResult<R>(s);
+    }
+
+    // Enqueues "f(T&)", and calls "onDone" with its result (or without
+    // arguments if it returns void). "onDone" executes in the strand, so it
+    // should be short, or post the rest of the work elsewhere.
+    template <typename F, typename C,
+              typename = typename std::enable_if<
+                  !std::is_convertible<C, Priority>::value>::type>
+    void apply(F f, C onDone, Priority prio = Priority::Normal) {
+        using R = decltype(f(std::declval<T&>()));
+        m_strand.post(
+            [this, f, onDone]() mutable {
+                complete(f, onDone, std::is_void<R>());
+            },
+            prio);
+    }
+
+    Strand<Processor, Lock>& strand() {
+        return m_strand;
+    }
+
+private:
+    template <typename F, typename C>
+    void complete(F& f, C& onDone, std::false_type) {
+        onDone(f(m_t));
+    }
+
+    template <typename F, typename C>
+    void complete(F& f, C& onDone, std::true_type) {
+        f(m_t);
+        onDone();
+    }
+
+    static void resumeOn(void* proc, std::function<void()> fn,
+                         Priority prio) {
+        detail::pushWithPriority(*static_cast<Processor*>(proc),
+                                 std::move(fn), prio);
+    }
+
+    T m_t;
+    Processor& m_proc;
+    Strand<Processor, Lock> m_strand;
+};
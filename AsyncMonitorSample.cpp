@@ -0,0 +1,160 @@
+#include "AsyncMonitor.h"
+#include "Monitor.h"
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 4;
+// Updates to a shared ledger, each holding it for a while
+const int kUpdates = 100;
+const int kUpdateMs = 2;
+// Short handlers, posted to their own strands meanwhile
+const int kNumShort = 4;
+const int kTickMs = 1;
+// Round trips from a thread outside the pool, with futures
+const int kRoundTrips = 20000;
+
+struct Ledger {
+    uint64_t balance = 0;
+    int updates = 0;
+};
+
+void update(Ledger& ledger) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kUpdateMs));
+    ledger.balance += 10;
+    ledger.updates++;
+}
+
+enum class Mode { Blocking, Callback, Coroutine };
+
+const char* toString(Mode mode) {
+    switch (mode) {
+    case Mode::Blocking: return "Monitor";
+    case Mode::Callback: return "AsyncMonitor";
+    case Mode::Coroutine: return "AsyncMonitor co_await";
+    }
+    return "";
+}
+
+#if CZ_HAS_COROUTINES
+Job updateAndReport(AsyncMonitor<Ledger, WorkQueue>& ledger,
+                    cz::Semaphore& finished) {
+    int n = co_await ledger.apply([](Ledger& l) {
+        update(l);
+        return l.updates;
+    });
+    (void)n;
+    finished.notify();
+}
+#endif
+
+void run(Mode mode) {
+    std::vector<std::unique_ptr<Strand<WorkQueue>>> shortStrands;
+    WorkQueue workQueue;
+    Monitor<Ledger> blocking;
+    AsyncMonitor<Ledger, WorkQueue> async(workQueue);
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    for (int i = 0; i < kNumShort; i++)
+        shortStrands.push_back(std::make_unique<Strand<WorkQueue>>(workQueue));
+
+    cz::Semaphore finished;
+    auto start = nowMs();
+    for (int i = 0; i < kUpdates; i++) {
+        switch (mode) {
+        case Mode::Blocking:
+            // Workers block waiting for the ledger
+            workQueue.push([&] {
+                blocking([](Ledger& l) { update(l); });
+                finished.notify();
+            });
+            break;
+        case Mode::Callback:
+            workQueue.push([&] {
+                async.apply(
+                    [](Ledger& l) {
+                        update(l);
+                        return l.updates;
+                    },
+                    [&](int) { finished.notify(); });
+            });
+            break;
+        case Mode::Coroutine:
+#if CZ_HAS_COROUTINES
+            workQueue.push([&] { updateAndReport(async, finished); });
+#endif
+            break;
+        }
+    }
+
+    // Short handlers keep coming while the updates are processed
+    Ticker<Strand<WorkQueue>> ticker(shortStrands, kTickMs);
+
+    for (int i = 0; i < kUpdates; i++)
+        finished.wait();
+    auto elapsed = nowMs() - start;
+    ticker.stop();
+
+    int updates = mode == Mode::Blocking
+                      ? blocking([](Ledger& l) { return l.updates; })
+                      : async.apply([](Ledger& l) { return l.updates; }).get();
+    printf("%-21s: %d updates took %7.2fms, %3d short handlers, latency "
+           "avg=%6.3fms max=%6.3fms\n",
+           toString(mode), updates, elapsed, ticker.latencies.count,
+           ticker.latencies.avg(), ticker.latencies.max);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads)
+        t.join();
+}
+
+// Cost of a round trip through the monitor's strand, from a thread outside the
+// pool waiting on the future
+void roundTrips() {
+    WorkQueue workQueue;
+    AsyncMonitor<Ledger, WorkQueue> ledger(workQueue);
+    std::thread worker([&workQueue] { workQueue.run(); });
+
+    auto start = nowMs();
+    uint64_t balance = 0;
+    for (int i = 0; i < kRoundTrips; i++) {
+        balance = ledger
+                      .apply([](Ledger& l) {
+                          l.balance++;
+                          return l.balance;
+                      })
+                      .get();
+    }
+    auto elapsed = nowMs() - start;
+    printf("apply().get(): %d round trips, %6.2fus each (balance %llu)\n",
+           kRoundTrips, elapsed * 1000 / kRoundTrips,
+           static_cast<unsigned long long>(balance));
+
+    workQueue.stop();
+    worker.join();
+}
+
+}  // namespace
+
+void asyncMonitorSample() {
+    printf("%d threads, %d ledger updates of %dms, short handlers every %dms\n",
+           kNumThreads, kUpdates, kUpdateMs, kTickMs);
+    run(Mode::Blocking);
+    run(Mode::Callback);
+#if CZ_HAS_COROUTINES
+    run(Mode::Coroutine);
+#else
+    printf("%-21s: not supported by the compiler\n",
+           toString(Mode::Coroutine));
+#endif
+    roundTrips();
+}
@@ -0,0 +1,135 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Coroutine.h"
+#include "Semaphore.h"
+#include "WaitGroup.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 4;
+// Handlers waiting for the uploads to finish, and then for a token each
+const int kNumWaiters = 200;
+// Uploads, finished by a thread outside the pool, one per tick
+const int kUploads = 50;
+const int kUploadUs = 200;
+// Short handlers, posted to their own strands meanwhile
+const int kNumShort = 4;
+const int kTickMs = 1;
+
+enum class Mode { Blocking, Async, Coroutine };
+
+const char* toString(Mode mode) {
+    switch (mode) {
+    case Mode::Blocking: return "wait";
+    case Mode::Async: return "async_wait";
+    case Mode::Coroutine: return "co_await async_wait";
+    }
+    return "";
+}
+
+struct Shared {
+    cz::ZeroSemaphore uploads;
+    cz::Semaphore tokens;
+    cz::WaitGroup finished;
+};
+
+#if CZ_HAS_COROUTINES
+Job waitAndFinish(Strand<WorkQueue>& strand, Shared& shared) {
+    co_await shared.uploads.async_wait(strand);
+    co_await shared.tokens.async_wait(strand);
+    shared.finished.done();
+}
+#endif
+
+void run(Mode mode) {
+    std::vector<std::unique_ptr<Strand<WorkQueue>>> strands;
+    std::vector<std::unique_ptr<Strand<WorkQueue>>> shortStrands;
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    for (int i = 0; i < kNumWaiters; i++)
+        strands.push_back(std::make_unique<Strand<WorkQueue>>(workQueue));
+    for (int i = 0; i < kNumShort; i++)
+        shortStrands.push_back(std::make_unique<Strand<WorkQueue>>(workQueue));
+
+    Shared shared;
+    for (int i = 0; i < kUploads; i++)
+        shared.uploads.increment();
+    shared.finished.add(kNumWaiters);
+
+    auto start = nowMs();
+    for (auto&& s : strands) {
+        Strand<WorkQueue>* strand = s.get();
+        switch (mode) {
+        case Mode::Blocking:
+            strand->post([&shared] {
+                shared.uploads.wait();
+                shared.tokens.wait();
+                shared.finished.done();
+            });
+            break;
+        case Mode::Async:
+            strand->post([strand, &shared] {
+                shared.uploads.async_wait(*strand, [strand, &shared] {
+                    shared.tokens.async_wait(
+                        *strand, [&shared] { shared.finished.done(); });
+                });
+            });
+            break;
+        case Mode::Coroutine:
+#if CZ_HAS_COROUTINES
+            strand->post([strand, &shared] { waitAndFinish(*strand, shared); });
+#endif
+            break;
+        }
+    }
+
+    // Uploads finish from outside the pool, and then the tokens are handed out
+    std::thread uploader([&shared] {
+        for (int i = 0; i < kUploads; i++) {
+            std::this_thread::sleep_for(std::chrono::microseconds(kUploadUs));
+            shared.uploads.decrement();
+        }
+        shared.tokens.notify(kNumWaiters / 2);
+        for (int i = 0; i < kNumWaiters / 2; i++)
+            shared.tokens.notify();
+    });
+
+    // Short handlers keep coming while the waiters wait
+    Ticker<Strand<WorkQueue>> ticker(shortStrands, kTickMs);
+
+    shared.finished.wait();
+    auto elapsed = nowMs() - start;
+    uploader.join();
+    ticker.stop();
+
+    printf("%-19s: %d waiters done in %7.2fms, %3d short handlers, latency "
+           "avg=%6.3fms max=%6.3fms\n",
+           toString(mode), kNumWaiters, elapsed, ticker.latencies.count,
+           ticker.latencies.avg(), ticker.latencies.max);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads)
+        t.join();
+}
+
+}  // namespace
+
+void asyncWaitSample() {
+    printf("%d threads, %d handlers waiting for %d uploads (one every %dus) "
+           "and a token each, short handlers every %dms\n",
+           kNumThreads, kNumWaiters, kUploads, kUploadUs, kTickMs);
+    run(Mode::Blocking);
+    run(Mode::Async);
+#if CZ_HAS_COROUTINES
+    run(Mode::Coroutine);
+#else
+    printf("%-19s: not supported by the compiler\n", toString(Mode::Coroutine));
+#endif
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+
+// Assumed size of a cache line. Data written by different threads is kept at
+// least this far apart, so the threads don't invalidate each other's cache
+// lines (false sharing).
+// std::hardware_destructive_interference_size would be the standard way, but
+// standard libraries were slow to provide it (and some still don't), so a
+// fixed value is used instead.
+static const size_t kCacheLineSize = 64;
+
+// Wraps a value in its own cache line(s).
+// Note that before C++17, heap allocations don't respect the alignment, and
+// only the padding is guaranteed.
+template <typename T>
+struct alignas(kCacheLineSize) CacheAligned {
+    T value;
+};
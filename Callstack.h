@@ -87,5 +87,5 @@ private:
 };
  
 template <typename Key, typename Value>
-typename thread_local Callstack<Key, Value>::Context*
+thread_local typename Callstack<Key, Value>::Context*
     Callstack<Key, Value>::ms_top = nullptr;
\ No newline at end of file
@@ -0,0 +1,182 @@
+#pragma once
+#include "CacheLine.h"
+#include "Locks.h"
+#include <exception>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace detail {
+
+// Operation published by a CombiningMonitor caller, for the combiner to
+// execute
+template <typename T>
+struct CombinedOp {
+    void (*run)(CombinedOp* op, T& t);
+    std::exception_ptr error;
+};
+
+template <typename T, typename F, typename R>
+struct CombinedOpImpl : CombinedOp<T> {
+    static_assert(!std::is_reference<R>::value,
+                  "Returning references to the protected data is not safe");
+
+    explicit CombinedOpImpl(F& f) : f(f) {
+        this->run = &runImpl;
+    }
+    ~CombinedOpImpl() {
+        if (hasResult)
+            result().~R();
+    }
+
+    static void runImpl(CombinedOp<T>* base, T& t) {
+        auto op = static_cast<CombinedOpImpl*>(base);
+        new (&op->storage) R(op->f(t));
+        op->hasResult = true;
+    }
+
+    R& result() {
+        return *reinterpret_cast<R*>(&storage);
+    }
+
+    R take() {
+        return std::move(result());
+    }
+
+    F& f;
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type storage;
+    bool hasResult = false;
+};
+
+template <typename T, typename F>
+struct CombinedOpImpl<T, F, void> : CombinedOp<T> {
+    explicit CombinedOpImpl(F& f) : f(f) {
+        this->run = &runImpl;
+    }
+
+    static void runImpl(CombinedOp<T>* base, T& t) {
+        static_cast<CombinedOpImpl*>(base)->f(t);
+    }
+
+    void take() {}
+
+    F& f;
+};
+
+}  // namespace detail
+
+//
+// Monitor using flat combining, for objects many threads hammer at once.
+//
+// Instead of every thread taking the lock in turn (and dragging the object's
+// cache lines to its core), threads publish their operation in a slot, and
+// whichever thread gets the lock executes all the published operations in a
+// batch, while the object is hot in its cache. The other threads wait for
+// their operation to be marked as done, and get the result (or exception).
+//
+// Operations execute in whichever thread is combining, so they must not rely
+// on thread local state, nor use the monitor recursively.
+// Threads that can't find a free slot fall back to taking the lock.
+//
+template <class T>
+class CombiningMonitor {
+public:
+    using Type = T;
+    CombiningMonitor() {}
+    CombiningMonitor(T t_) : m_t(std::move(t_)) {}
+
+    CombiningMonitor(const CombiningMonitor&) = delete;
+    CombiningMonitor& operator=(const CombiningMonitor&) = delete;
+
+    template <typename F>
+    auto operator()(F f) -> decltype(f(std::declval<T&>())) {
+        using R = decltype(f(std::declval<T&>()));
+        detail::CombinedOpImpl<T, F, R> op(f);
+
+        Slot* slot = claimSlot();
+        if (!slot) {
+            std::lock_guard<SpinLock> hold(m_lock);
+            return f(m_t);
+        }
+
+        slot->op.store(&op, std::memory_order_release);
+        detail::Backoff backoff;
+        while (slot->op.load(std::memory_order_acquire)) {
+            if (m_lock.try_lock()) {
+                combine();
+                m_lock.unlock();
+            } else {
+                backoff.pause();
+            }
+        }
+        slot->inUse.store(false, std::memory_order_release);
+
+        if (op.error)
+            std::rethrow_exception(op.error);
+        return op.take();
+    }
+
+private:
+    static const unsigned kSlots = 64;
+    // Passes over the slots per combining round, to pick up the operations
+    // published while combining
+    static const unsigned kPasses = 2;
+
+    struct Slot {
+        // Claimed by a thread
+        std::atomic<bool> inUse;
+        // Operation waiting to be executed. Cleared by the combiner once done
+        std::atomic<detail::CombinedOp<T>*> op;
+    };
+
+    Slot* claimSlot() {
+        // Threads get a home slot, so usually the first attempt succeeds
+        static std::atomic<unsigned> next(0);
+        static thread_local unsigned home = next++;
+        for (unsigned i = 0; i < kSlots; i++) {
+            unsigned index = (home + i) % kSlots;
+            Slot& slot = m_slots[index].value;
+            if (!slot.inUse.load(std::memory_order_relaxed) &&
+                !slot.inUse.exchange(true, std::memory_order_acquire)) {
+                // Combiners only scan up to the highest slot used
+                unsigned used = m_used.load(std::memory_order_relaxed);
+                while (used <= index &&
+                       !m_used.compare_exchange_weak(used, index + 1)) {
+                }
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    // Executes the published operations. Assumes m_lock is locked.
+    void combine() {
+        for (unsigned pass = 0; pass < kPasses; pass++) {
+            bool found = false;
+            unsigned used = m_used.load(std::memory_order_acquire);
+            for (unsigned i = 0; i < used; i++) {
+                Slot& slot = m_slots[i].value;
+                detail::CombinedOp<T>* op =
+                    slot.op.load(std::memory_order_acquire);
+                if (!op)
+                    continue;
+                found = true;
+                try {
+                    op->run(op, m_t);
+                } catch (...) {
+                    op->error = std::current_exception();
+                }
+                slot.op.store(nullptr, std::memory_order_release);
+            }
+            if (!found)
+                break;
+        }
+    }
+
+    T m_t;
+    SpinLock m_lock;
+    CacheAligned<Slot> m_slots[kSlots] = {};
+    std::atomic<unsigned> m_used{0};
+};
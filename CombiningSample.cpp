@@ -0,0 +1,62 @@
+#include "CombiningMonitor.h"
+#include "Locks.h"
+#include "Monitor.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Total operations, split between the threads
+const int kOps = 1000000;
+
+// Heavily shared object: a priority queue threads push to and pop from
+using Heap = std::priority_queue<uint64_t>;
+
+template <typename M>
+double run(int numThreads) {
+    M heap;
+    std::atomic<uint64_t> checksum(0);
+    std::vector<std::thread> threads;
+    auto start = nowMs();
+    for (int t = 0; t < numThreads; t++) {
+        threads.push_back(std::thread([&heap, &checksum, numThreads, t] {
+            uint64_t sum = 0;
+            uint64_t v = t;
+            for (int i = 0; i < kOps / numThreads; i++) {
+                v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+                if (i % 2 == 0) {
+                    heap([v](Heap& h) { h.push(v >> 32); });
+                } else {
+                    sum += heap([](Heap& h) {
+                        uint64_t top = h.top();
+                        h.pop();
+                        return top;
+                    });
+                }
+            }
+            checksum += sum;
+        }));
+    }
+    for (auto&& t : threads)
+        t.join();
+    return (nowMs() - start) * 1000000 / kOps;
+}
+
+}  // namespace
+
+void combiningSample() {
+    printf("Nanoseconds per operation on a shared priority queue\n");
+    for (int numThreads : {1, 2, 4, 8, 16}) {
+        printf("%2d threads: Monitor<std::mutex> %7.1fns, Monitor<SpinLock> "
+               "%7.1fns, CombiningMonitor %7.1fns\n",
+               numThreads, run<Monitor<Heap>>(numThreads),
+               run<Monitor<Heap, SpinLock>>(numThreads),
+               run<CombiningMonitor<Heap>>(numThreads));
+    }
+}
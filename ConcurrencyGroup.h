@@ -0,0 +1,199 @@
+#pragma once
+#include "Callstack.h"
+#include "Continuation.h"
+#include "Monitor.h"
+#include "Priority.h"
+#include <assert.h>
+#include <stddef.h>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+//
+// Generalization of Strand, that allows up to "limit" handlers to execute
+// concurrently. It guards resources with limited concurrency (e.g: a storage
+// backend, or a library licensed for a number of threads) without blocking
+// workers, since excess handlers are queued instead of waiting on a semaphore.
+// It guarantees the following:
+// - No more than "limit" handlers execute concurrently
+// - Handlers are only executed from the specified Processor
+// - Handler execution order is not guaranteed
+//
+// Each of the (up to "limit") work items the group pushes to the Processor
+// executes handlers until the group's queue is empty. That work item inherits
+// the priority of the handler that caused it to be pushed. As with Strand,
+// handlers can return a Continuation to give up their worker, and the group
+// must outlive any work pending in the Processor.
+//
+// Specified Processor must implement the same interface as for Strand.
+//
+// "Lock" is the lock protecting the group's state, as with Strand.
+//
+template <typename Processor, typename Lock = std::mutex>
+class ConcurrencyGroup {
+public:
+    // Any extra arguments are passed to the lock's constructor (e.g: the
+    // name of a ProfiledLock)
+    template <typename... LockArgs>
+    ConcurrencyGroup(Processor& proc, unsigned limit, LockArgs&&... lockArgs)
+        : m_data(Data(), std::forward<LockArgs>(lockArgs)...),
+          m_proc(proc),
+          m_limit(limit) {
+        assert(limit > 0);
+    }
+
+    ConcurrencyGroup(const ConcurrencyGroup&) = delete;
+    ConcurrencyGroup& operator=(const ConcurrencyGroup&) = delete;
+
+    // Executes the handler immediately if called from one of the group's
+    // handlers, or from the Processor with the limit not reached. Otherwise it
+    // posts the handler.
+    template <typename F>
+    void dispatch(F handler, Priority prio = Priority::Normal) {
+        std::function<void()> h =
+            wrap(std::move(handler), detail::returnsContinuation<F>());
+
+        // Executing within one of our handlers doesn't add to the concurrency
+        if (runningInThisThread()) {
+            h();
+            return;
+        }
+
+        if (!m_proc.canDispatch()) {
+            post(std::move(h), prio);
+            return;
+        }
+
+        bool acquired = m_data([&](Data& data) {
+            if (data.inFlight < m_limit) {
+                data.inFlight++;
+                return true;
+            }
+            data.q.push(std::move(h));
+            return false;
+        });
+        if (acquired)
+            run(std::move(h), prio);
+    }
+
+    // Post an handler for execution and returns immediately.
+    // The handler is never executed as part of this call.
+    template <typename F>
+    void post(F handler, Priority prio = Priority::Normal) {
+        std::function<void()> h =
+            wrap(std::move(handler), detail::returnsContinuation<F>());
+        bool start = m_data([&](Data& data) {
+            if (data.inFlight < m_limit) {
+                data.inFlight++;
+                return true;
+            }
+            data.q.push(std::move(h));
+            return false;
+        });
+
+        if (start) {
+            detail::pushWithPriority(
+                m_proc,
+                [this, h, prio]() mutable { run(std::move(h), prio); }, prio);
+        }
+    }
+
+    // Checks if we are currently executing one of the group's handlers in
+    // this thread
+    bool runningInThisThread() {
+        return Callstack<ConcurrencyGroup, Slot>::contains(this) != nullptr;
+    }
+
+    unsigned limit() const {
+        return m_limit;
+    }
+
+    // Number of handlers executing (or about to) concurrently. Never more
+    // than "limit"
+    unsigned inFlight() const {
+        return m_data([](Data& data) { return data.inFlight; });
+    }
+
+    // Number of handlers waiting for the number of in-flight handlers to drop
+    size_t queued() const {
+        return m_data([](Data& data) { return data.q.size(); });
+    }
+
+private:
+    // State of a work item executing the group's handlers
+    struct Slot {
+        // Continuation of the handler that just yielded
+        Continuation yield;
+    };
+
+    template <typename F>
+    std::function<void()> wrap(F handler, std::true_type) {
+        return [this, handler]() mutable { yieldLater(handler()); };
+    }
+
+    template <typename F>
+    std::function<void()> wrap(F handler, std::false_type) {
+        return std::function<void()>(std::move(handler));
+    }
+
+    // Makes the current work item give up its worker once the current
+    // handler returns, and execute "next" later
+    void yieldLater(Continuation next) {
+        if (!next)
+            return;
+        Slot* slot = Callstack<ConcurrencyGroup, Slot>::contains(this);
+        assert(slot);
+        if (slot->yield)
+            post(std::move(next));
+        else
+            slot->yield = std::move(next);
+    }
+
+    // Executes the handler (if any), and then any queued handlers.
+    // This assumes the work item is counted as in flight. When the queue is
+    // empty, it stops counting it.
+    void run(std::function<void()> handler, Priority prio) {
+        Slot slot;
+        typename Callstack<ConcurrencyGroup, Slot>::Context ctx(this, slot);
+        while (true) {
+            if (handler) {
+                handler();
+                handler = nullptr;
+            }
+
+            bool yield = false;
+            m_data([&](Data& data) {
+                if (slot.yield) {
+                    // Enqueue the rest of the work at the back, and push
+                    // another work item. This one stays counted as in flight
+                    // until that one executes.
+                    data.q.push(wrap(std::move(slot.yield), std::true_type()));
+                    slot.yield = Continuation();
+                    yield = true;
+                } else if (data.q.size()) {
+                    handler = std::move(data.q.front());
+                    data.q.pop();
+                } else {
+                    data.inFlight--;
+                }
+            });
+
+            if (yield) {
+                detail::deferWithPriority(
+                    m_proc, [this, prio] { run(nullptr, prio); }, prio);
+                return;
+            } else if (!handler) {
+                return;
+            }
+        }
+    }
+
+    struct Data {
+        unsigned inFlight = 0;
+        std::queue<std::function<void()>> q;
+    };
+    Monitor<Data, Lock> m_data;
+    Processor& m_proc;
+    const unsigned m_limit;
+};
@@ -0,0 +1,103 @@
+#include "ConcurrencyGroup.h"
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 4;
+// Backend allowing a limited number of concurrent calls, each taking a while
+const unsigned kBackendLimit = 2;
+const int kBackendCalls = 40;
+const int kBackendCallMs = 5;
+// Short handlers, posted to their own strands meanwhile
+const int kNumShort = 4;
+const int kTickMs = 1;
+
+// Stand-in for the backend, checking the limit is respected
+struct Backend {
+    void call() {
+        int n = ++concurrent;
+        assert(n <= static_cast<int>(kBackendLimit));
+        int prev = peak;
+        while (n > prev && !peak.compare_exchange_weak(prev, n)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kBackendCallMs));
+        concurrent--;
+    }
+
+    std::atomic<int> concurrent{0};
+    std::atomic<int> peak{0};
+};
+
+void run(bool useGroup) {
+    std::vector<std::unique_ptr<Strand<WorkQueue>>> shortStrands;
+    WorkQueue workQueue;
+    ConcurrencyGroup<WorkQueue> group(workQueue, kBackendLimit);
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    for (int i = 0; i < kNumShort; i++)
+        shortStrands.push_back(std::make_unique<Strand<WorkQueue>>(workQueue));
+
+    Backend backend;
+    cz::Semaphore slots(kBackendLimit);
+    cz::Semaphore finished;
+    auto start = nowMs();
+    for (int i = 0; i < kBackendCalls; i++) {
+        if (useGroup) {
+            group.post([&] {
+                backend.call();
+                finished.notify();
+            });
+        } else {
+            // Workers block waiting for the backend
+            workQueue.push([&] {
+                slots.wait();
+                backend.call();
+                slots.notify();
+                finished.notify();
+            });
+        }
+    }
+    unsigned inFlight = group.inFlight();
+    size_t queued = group.queued();
+
+    // Short handlers keep coming while the backend calls are processed
+    Ticker<Strand<WorkQueue>> ticker(shortStrands, kTickMs);
+
+    for (int i = 0; i < kBackendCalls; i++)
+        finished.wait();
+    auto elapsed = nowMs() - start;
+    ticker.stop();
+
+    printf("%-16s: calls took %7.2fms (peak concurrency %d), %3d short "
+           "handlers, latency avg=%6.3fms max=%6.3fms\n",
+           useGroup ? "ConcurrencyGroup" : "Semaphore", elapsed,
+           backend.peak.load(), ticker.latencies.count,
+           ticker.latencies.avg(), ticker.latencies.max);
+    if (useGroup)
+        printf("%-16s  after posting: %u in flight, %zu queued\n", "",
+               inFlight, queued);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads)
+        t.join();
+}
+
+}  // namespace
+
+void concurrencySample() {
+    printf("%d threads, %d backend calls of %dms, at most %u concurrently, "
+           "short handlers every %dms\n",
+           kNumThreads, kBackendCalls, kBackendCallMs, kBackendLimit, kTickMs);
+    run(false);
+    run(true);
+}
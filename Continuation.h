@@ -0,0 +1,99 @@
+#pragma once
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+//
+// Remainder of a long running handler's work.
+//
+// Handlers posted to a Strand or pushed to a Processor (WorkQueue,
+// LockFreeWorkQueue, NumaWorkQueue, ShardedExecutor) can return a Continuation
+// instead of void, to give up their worker partway through. If the returned
+// Continuation is not empty, it's enqueued at the back of the strand (or
+// queue), so anything queued meanwhile gets to execute first. A continuation
+// can itself return another Continuation, and so on, until it returns an
+// empty one.
+//
+//	strand.post([job]() -> Continuation {
+//		job->doSomeWork();
+//		if (job->finished())
+//			return {};
+//		return job->next();
+//	});
+//
+class Continuation {
+public:
+    // Empty continuation, meaning there is no more work
+    Continuation() {}
+
+    // "f" must be callable as "Continuation f()"
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<F>::type, Continuation>::value>::type>
+    Continuation(F f) : m_fn(std::move(f)) {}
+
+    explicit operator bool() const {
+        return static_cast<bool>(m_fn);
+    }
+
+    // Executes the next step
+    Continuation operator()() {
+        return m_fn();
+    }
+
+private:
+    std::function<Continuation()> m_fn;
+};
+
+namespace detail {
+
+// Tells if a handler returns a Continuation
+template <typename F, typename = void>
+struct returnsContinuation : std::false_type {};
+
+template <typename F>
+struct returnsContinuation<F, decltype(void(std::declval<F&>()()))>
+    : std::is_same<decltype(std::declval<F&>()()), Continuation> {};
+
+// Makes a Continuation out of any handler
+template <typename F>
+Continuation toContinuation(F handler, std::true_type) {
+    return Continuation(std::move(handler));
+}
+
+template <typename F>
+Continuation toContinuation(F handler, std::false_type) {
+    return Continuation([handler]() mutable {
+        handler();
+        return Continuation();
+    });
+}
+
+template <typename F>
+Continuation toContinuation(F handler) {
+    return toContinuation(std::move(handler), returnsContinuation<F>());
+}
+
+// Makes a work item out of a handler, for executors where pushing work puts it
+// behind anything already queued. If the handler returns a Continuation, it's
+// pushed to the executor again.
+template <typename Executor, typename F>
+std::function<void()> repushing(Executor& ex, F handler, std::true_type) {
+    return [&ex, handler]() mutable {
+        Continuation next = handler();
+        if (next)
+            ex.push(std::move(next));
+    };
+}
+
+template <typename Executor, typename F>
+std::function<void()> repushing(Executor&, F handler, std::false_type) {
+    return std::function<void()>(std::move(handler));
+}
+
+template <typename Executor, typename F>
+std::function<void()> repushing(Executor& ex, F handler) {
+    return repushing(ex, std::move(handler), returnsContinuation<F>());
+}
+
+}  // namespace detail
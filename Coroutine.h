@@ -0,0 +1,101 @@
+#pragma once
+
+//
+// Coroutine support, when the compiler has it (C++20).
+//
+// A Job is a fire-and-forget coroutine, and "co_await yield(executor)" gives
+// up the worker, resuming the coroutine later through "executor.defer". The
+// executor can be a Strand (so the coroutine keeps the strand's guarantees),
+// or a WorkQueue.
+//
+//	Job process(Strand<WorkQueue>& strand, Data& data) {
+//		for (auto&& item : data.items) {
+//			processItem(item);
+//			co_await yield(strand);
+//		}
+//	}
+//
+// Since the coroutine runs until its first "co_await" in the calling thread,
+// start it from a handler of the strand it yields to.
+//
+// Semaphores and wait groups can be awaited the same way, without blocking the
+// worker, with "co_await sem.async_wait(executor)".
+//
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define CZ_HAS_COROUTINES 1
+#include <coroutine>
+#include <exception>
+
+class Job {
+public:
+    struct promise_type {
+        Job get_return_object() {
+            return Job();
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        // Nobody is waiting for the job, so there is no one to report to
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+template <typename Executor>
+class YieldAwaiter {
+public:
+    explicit YieldAwaiter(Executor& ex) : m_ex(ex) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        m_ex.defer([h] { h.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    Executor& m_ex;
+};
+
+// Suspends the coroutine, and resumes it from "ex", after anything already
+// queued there
+template <typename Executor>
+YieldAwaiter<Executor> yield(Executor& ex) {
+    return YieldAwaiter<Executor>(ex);
+}
+
+// Suspends the coroutine until "waitable" (e.g: cz::Semaphore, cz::WaitGroup)
+// is signaled, and resumes it from "ex". Doesn't suspend if it's already
+// signaled.
+template <typename Waitable, typename Executor>
+class AsyncWaitAwaiter {
+public:
+    AsyncWaitAwaiter(Waitable& waitable, Executor& ex)
+        : m_waitable(waitable), m_ex(ex) {}
+
+    bool await_ready() {
+        return m_waitable.trywait();
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        m_waitable.async_wait(m_ex, [h] { h.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    Waitable& m_waitable;
+    Executor& m_ex;
+};
+
+#endif
+#endif
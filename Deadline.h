@@ -0,0 +1,38 @@
+#pragma once
+#include <chrono>
+#include <functional>
+
+//
+// Time by which a handler must start executing, for its result to still be
+// useful (e.g: the client that requested it times out by then).
+// Processors that support deadlines skip expired handlers, and execute the
+// optional "onExpired" callback instead.
+//
+struct Deadline {
+    using Clock = std::chrono::steady_clock;
+
+    // No deadline
+    Deadline() {}
+
+    Deadline(Clock::time_point at, std::function<void()> onExpired = nullptr)
+        : at(at), onExpired(std::move(onExpired)) {}
+
+    // Deadline "ms" milliseconds from now
+    static Deadline in(double ms, std::function<void()> onExpired = nullptr) {
+        return Deadline(Clock::now() +
+                            std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double, std::milli>(ms)),
+                        std::move(onExpired));
+    }
+
+    bool isSet() const {
+        return at != Clock::time_point::max();
+    }
+
+    bool expired(Clock::time_point now) const {
+        return now > at;
+    }
+
+    Clock::time_point at = Clock::time_point::max();
+    std::function<void()> onExpired;
+};
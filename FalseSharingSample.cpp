@@ -0,0 +1,175 @@
+#include "CacheLine.h"
+#include "LockFreeWorkQueue.h"
+#include "NumaWorkQueue.h"
+#include "PerWorker.h"
+#include "ShardedExecutor.h"
+#include "Strand.h"
+#include "WaitGroup.h"
+#include "WorkQueue.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 4;
+const int kIncrements = 20000000;
+// Ratio of packed to padded time above which we report false sharing
+const double kFalseSharingRatio = 1.5;
+const int kNumObjs = 16;
+// Work items counted per worker, on each executor
+const int kPerWorkerItems = 100000;
+
+// Counter only its owner writes, so it doesn't need atomic increments, but
+// readers can still look at it
+struct Counter {
+    void inc() {
+        n.store(n.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    }
+    std::atomic<uint64_t> n{0};
+};
+
+// Each thread increments its own counter. Returns nanoseconds per increment
+template <typename GetCounter>
+double hammer(GetCounter getCounter) {
+    std::vector<std::thread> threads;
+    auto start = nowMs();
+    for (int t = 0; t < kNumThreads; t++) {
+        threads.push_back(std::thread([getCounter, t] {
+            WorkerId::Scope id(t);
+            Counter& c = getCounter(t);
+            for (int i = 0; i < kIncrements / kNumThreads; i++)
+                c.inc();
+        }));
+    }
+    for (auto&& t : threads)
+        t.join();
+    return (nowMs() - start) * 1000000 / kIncrements;
+}
+
+// Number of heap allocated objects not starting and ending at a cache line
+// boundary, which can share cache lines with neighbouring allocations.
+// Before C++17, "new" doesn't have to respect the type's alignment.
+template <typename T, typename Make>
+int unaligned(Make make) {
+    std::vector<std::unique_ptr<T>> objs;
+    for (int i = 0; i < kNumObjs; i++)
+        objs.push_back(make());
+    int count = 0;
+    for (auto&& obj : objs) {
+        uintptr_t begin = reinterpret_cast<uintptr_t>(obj.get());
+        if (begin % kCacheLineSize || (begin + sizeof(T)) % kCacheLineSize)
+            count++;
+    }
+    return count;
+}
+
+template <typename T>
+void printLayout(const char* name, int unaligned) {
+    printf("%-20s: sizeof=%4zu alignof=%3zu, %2d of %d heap allocated objects "
+           "not on cache line boundaries%s\n",
+           name, sizeof(T), alignof(T), unaligned, kNumObjs,
+           alignof(T) < kCacheLineSize ? ", NOT CACHE LINE ALIGNED" : "");
+}
+
+// Work items counting in their worker's slot, which relies on the executor
+// setting the worker index
+template <typename Executor>
+void countPerWorker(const char* name, Executor& ex) {
+    PerWorker<Counter> counts(kNumThreads);
+    cz::WaitGroup done(kPerWorkerItems);
+    for (int i = 0; i < kPerWorkerItems; i++) {
+        ex.push([&counts, &done] {
+            counts.local().inc();
+            done.done();
+        });
+    }
+    done.wait();
+
+    uint64_t total = counts.combine(
+        uint64_t(0), [](uint64_t acc, const Counter& c) { return acc + c.n; });
+    int workers = counts.combine(
+        0, [](int acc, const Counter& c) { return acc + (c.n ? 1 : 0); });
+    printf("%-20s: %llu items counted by %d workers\n", name,
+           static_cast<unsigned long long>(total), workers);
+    assert(total == kPerWorkerItems);
+}
+
+template <typename Queue>
+void countPerWorkerThreads(const char* name) {
+    Queue queue;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; i++)
+        threads.push_back(std::thread([&queue] { queue.run(); }));
+    countPerWorker(name, queue);
+    queue.stop();
+    for (auto&& t : threads)
+        t.join();
+}
+
+void countPerWorkerAll() {
+    printf("PerWorker on each executor, with %d workers\n", kNumThreads);
+    countPerWorkerThreads<WorkQueue>("WorkQueue");
+    countPerWorkerThreads<LockFreeWorkQueue>("LockFreeWorkQueue");
+
+    NumaWorkQueue::Options numaOpts;
+    numaOpts.topology = Topology::singleNode();
+    numaOpts.threadsPerNode = kNumThreads;
+    numaOpts.pinning = NumaWorkQueue::Pinning::None;
+    NumaWorkQueue numa(numaOpts);
+    countPerWorker("NumaWorkQueue", numa);
+    numa.stop();
+
+    ShardedExecutor::Options shardedOpts;
+    shardedOpts.numShards = kNumThreads;
+    shardedOpts.pinning = false;
+    ShardedExecutor sharded(shardedOpts);
+    countPerWorker("ShardedExecutor", sharded);
+    sharded.stop();
+}
+
+}  // namespace
+
+void falseSharingSample() {
+    // Layout of the hot structures
+    WorkQueue workQueue;
+    printLayout<Strand<WorkQueue>>(
+        "Strand<WorkQueue>", unaligned<Strand<WorkQueue>>([&workQueue] {
+            return std::make_unique<Strand<WorkQueue>>(workQueue);
+        }));
+    printLayout<WorkQueue>("WorkQueue", unaligned<WorkQueue>([] {
+                               return std::make_unique<WorkQueue>();
+                           }));
+
+    // Threads writing their own counters, next to each other or not
+    printf("%d threads, %d increments of their own counter\n", kNumThreads,
+           kIncrements);
+    Counter packed[kNumThreads];
+    double packedNs = hammer([&packed](int t) -> Counter& { return packed[t]; });
+    CacheAligned<Counter> padded[kNumThreads];
+    double paddedNs =
+        hammer([&padded](int t) -> Counter& { return padded[t].value; });
+    PerWorker<Counter> perWorker(kNumThreads);
+    double perWorkerNs =
+        hammer([&perWorker](int) -> Counter& { return perWorker.local(); });
+
+    uint64_t total = perWorker.combine(
+        uint64_t(0), [](uint64_t acc, const Counter& c) { return acc + c.n; });
+    printf("%-20s: %6.2fns per increment\n", "Packed", packedNs);
+    printf("%-20s: %6.2fns per increment\n", "CacheAligned", paddedNs);
+    printf("%-20s: %6.2fns per increment (total %llu)\n", "PerWorker",
+           perWorkerNs, static_cast<unsigned long long>(total));
+    double ratio = packedNs / std::min(paddedNs, perWorkerNs);
+    printf("Packed/padded ratio %.2f: %s\n", ratio,
+           ratio > kFalseSharingRatio
+               ? "false sharing between the packed counters"
+               : "no false sharing measured (too few cores?)");
+
+    countPerWorkerAll();
+}
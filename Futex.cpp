@@ -0,0 +1,143 @@
+#include "Futex.h"
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "The kernel needs to see the atomic as a plain 32 bits word");
+
+#if defined(_WIN32)
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected) {
+    WaitOnAddress(&word, &expected, sizeof(expected), INFINITE);
+}
+
+bool futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected,
+                  std::chrono::nanoseconds timeout) {
+    using namespace std::chrono;
+    // Rounded up, so short timeouts don't become busy loops
+    auto ms = duration_cast<milliseconds>(timeout + milliseconds(1) -
+                                          nanoseconds(1));
+    if (WaitOnAddress(&word, &expected, sizeof(expected),
+                      static_cast<DWORD>(ms.count())))
+        return true;
+    return GetLastError() != ERROR_TIMEOUT;
+}
+
+void futexWakeOne(std::atomic<uint32_t>& word) {
+    WakeByAddressSingle(&word);
+}
+
+void futexWakeAll(std::atomic<uint32_t>& word) {
+    WakeByAddressAll(&word);
+}
+
+void futexWake(std::atomic<uint32_t>& word, unsigned int n) {
+    // There is no "wake n", and each call wakes up a different waiter
+    for (unsigned int i = 0; i < n; i++)
+        WakeByAddressSingle(&word);
+}
+
+#elif defined(__linux__)
+
+namespace {
+long futex(std::atomic<uint32_t>& word, int op, uint32_t val,
+           const timespec* timeout = nullptr) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+                   op | FUTEX_PRIVATE_FLAG, val, timeout, nullptr, 0);
+}
+}  // namespace
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected) {
+    futex(word, FUTEX_WAIT, expected);
+}
+
+bool futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected,
+                  std::chrono::nanoseconds timeout) {
+    if (timeout.count() <= 0)
+        return false;
+    // FUTEX_WAIT takes a relative timeout, measured against CLOCK_MONOTONIC
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+    return futex(word, FUTEX_WAIT, expected, &ts) == 0 || errno != ETIMEDOUT;
+}
+
+void futexWakeOne(std::atomic<uint32_t>& word) {
+    futex(word, FUTEX_WAKE, 1);
+}
+
+void futexWakeAll(std::atomic<uint32_t>& word) {
+    futex(word, FUTEX_WAKE, INT32_MAX);
+}
+
+void futexWake(std::atomic<uint32_t>& word, unsigned int n) {
+    futex(word, FUTEX_WAKE,
+          static_cast<uint32_t>(std::min<unsigned int>(n, INT32_MAX)));
+}
+
+#else
+
+namespace {
+// Waiters and wakers of the same word meet in the same bucket. Wakers lock the
+// bucket after changing the word, and waiters check the word with the bucket
+// locked, so no wake up is lost.
+struct Bucket {
+    std::mutex mtx;
+    std::condition_variable cond;
+};
+
+const size_t gNumBuckets = 64;
+
+Bucket& bucketFor(const void* addr) {
+    static Bucket buckets[gNumBuckets];
+    return buckets[(reinterpret_cast<uintptr_t>(addr) >> 4) % gNumBuckets];
+}
+}  // namespace
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected) {
+    Bucket& b = bucketFor(&word);
+    std::unique_lock<std::mutex> lock(b.mtx);
+    if (word.load() == expected)
+        b.cond.wait(lock);
+}
+
+bool futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected,
+                  std::chrono::nanoseconds timeout) {
+    Bucket& b = bucketFor(&word);
+    std::unique_lock<std::mutex> lock(b.mtx);
+    if (word.load() != expected)
+        return true;
+    return b.cond.wait_for(lock, timeout) == std::cv_status::no_timeout;
+}
+
+// Buckets are shared by several words, so all waiters are woken up
+void futexWakeOne(std::atomic<uint32_t>& word) {
+    futexWakeAll(word);
+}
+
+void futexWakeAll(std::atomic<uint32_t>& word) {
+    Bucket& b = bucketFor(&word);
+    std::lock_guard<std::mutex> lock(b.mtx);
+    b.cond.notify_all();
+}
+
+void futexWake(std::atomic<uint32_t>& word, unsigned int n) {
+    if (n)
+        futexWakeAll(word);
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+//
+// Minimal futex-like primitives, to put threads to sleep waiting for a 32 bits
+// word to change, without a mutex/condition variable pair per word.
+// Uses futex on Linux, WaitOnAddress on Windows, and a table of condition
+// variables (indexed by the word's address) elsewhere.
+//
+// As with futexes, waits can return spuriously, so callers must check the
+// word again. Wakes only use the word's address, so they can be called after
+// a woken up thread destroyed it.
+//
+
+// Sleeps while "word" equals "expected", unless woken up before that
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected);
+
+// Same as above, but gives up after "timeout". Returns false if it timed out
+bool futexWaitFor(std::atomic<uint32_t>& word, uint32_t expected,
+                  std::chrono::nanoseconds timeout);
+
+// Wakes up one/all of the threads waiting on "word"
+void futexWakeOne(std::atomic<uint32_t>& word);
+void futexWakeAll(std::atomic<uint32_t>& word);
+// Wakes up at most "n" of the threads waiting on "word"
+void futexWake(std::atomic<uint32_t>& word, unsigned int n);
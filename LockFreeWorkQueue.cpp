@@ -0,0 +1,111 @@
+#include "LockFreeWorkQueue.h"
+#include "PerWorker.h"
+#include <algorithm>
+#include <thread>
+
+namespace {
+// How many times a worker checks the ring before parking
+const int gSpinCount = 64;
+}  // namespace
+
+LockFreeWorkQueue::LockFreeWorkQueue(size_t capacity) : m_ring(capacity) {}
+
+void LockFreeWorkQueue::pushItem(std::function<void()> w) {
+    while (!m_ring.tryPush(w)) {
+        if (canDispatch()) {
+            // Spinning here would deadlock if we are the only worker, or if
+            // all workers are doing the same
+            std::lock_guard<std::mutex> lock(m_overflowMtx);
+            m_overflow.push_back(std::move(w));
+            m_overflowSize.value.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        std::this_thread::yield();
+    }
+
+    // Pairs with the fence in "pop": either the worker sees the item when
+    // checking the ring (or overflow queue) again, or we see the worker as a
+    // sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.value.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_epoch++;
+        m_cond.notify_one();
+    }
+}
+
+bool LockFreeWorkQueue::tryPopOverflow(std::function<void()>& w) {
+    if (m_overflowSize.value.load(std::memory_order_relaxed) == 0)
+        return false;
+    std::lock_guard<std::mutex> lock(m_overflowMtx);
+    if (m_overflow.empty())
+        return false;
+    w = std::move(m_overflow.front());
+    m_overflow.pop_front();
+    m_overflowSize.value.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::function<void()> LockFreeWorkQueue::pop() {
+    std::function<void()> w;
+    while (true) {
+        for (int i = 0; i < gSpinCount; i++) {
+            // Overflow first, so the shutdown item in the ring doesn't stop
+            // the workers while there are still overflowed items
+            if (tryPopOverflow(w) || m_ring.tryPop(w))
+                return w;
+        }
+
+        uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            epoch = m_epoch;
+        }
+        m_sleepers.value.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool found = tryPopOverflow(w) || m_ring.tryPop(w);
+        if (!found) {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond.wait(lock, [this, epoch] { return m_epoch != epoch; });
+        }
+        m_sleepers.value.fetch_sub(1, std::memory_order_relaxed);
+        if (found)
+            return w;
+    }
+}
+
+void LockFreeWorkQueue::run() {
+    unsigned index;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto it = std::find(m_usedIndexes.begin(), m_usedIndexes.end(), false);
+        index = static_cast<unsigned>(it - m_usedIndexes.begin());
+        if (it == m_usedIndexes.end())
+            m_usedIndexes.push_back(true);
+        else
+            *it = true;
+    }
+    runWorker(index);
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_usedIndexes[index] = false;
+}
+
+void LockFreeWorkQueue::runWorker(unsigned index) {
+    Callstack<LockFreeWorkQueue>::Context ctx(this);
+    WorkerId::Scope workerId(index);
+    while (true) {
+        std::function<void()> w = pop();
+        if (!w) {
+            // An empty work item means we are shutting down, so enqueue
+            // another empty work item. This will in turn shut down another
+            // thread that is executing "run"
+            pushItem(nullptr);
+            break;
+        }
+        w();
+    }
+}
+
+void LockFreeWorkQueue::stop() {
+    pushItem(nullptr);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "CacheLine.h"
+#include "Callstack.h"
+#include "Continuation.h"
+#include "MPMCRing.h"
+
+// Multiple producer / Multiple consumer work queue, as an alternative backend
+// to WorkQueue, built on a bounded lock-free ring (see MPMCRing.h).
+//
+// Pushing and popping items doesn't take any locks. Workers with nothing to
+// do spin briefly, and then park. Parking only takes a lock when a worker is
+// actually going to sleep, or when a push needs to wake one up.
+//
+// It implements the Processor interface (see Strand.h), but none of
+// WorkQueue's extras (priorities, pool mode, pollers, LIFO slots). The ring is
+// bounded, so "push" spins (yielding) while the ring is full. Pushes from this
+// queue's own workers can't wait for the ring to drain, since they might be
+// the ones draining it, so those go to a mutex protected overflow queue
+// instead, which workers check before the ring.
+class LockFreeWorkQueue {
+public:
+    // "capacity" is rounded up to a power of two
+    explicit LockFreeWorkQueue(size_t capacity = 4096);
+    LockFreeWorkQueue(const LockFreeWorkQueue&) = delete;
+    LockFreeWorkQueue& operator=(const LockFreeWorkQueue&) = delete;
+
+    // Add a new work item.
+    // If it returns a Continuation, the rest of its work is pushed again once
+    // it returns.
+    template <typename F>
+    void push(F w) {
+        pushItem(detail::repushing(*this, std::move(w)));
+    }
+
+    // Continuously waits for and executes any work items, until "stop" is
+    // called.
+    // The calling thread gets the lowest worker index not in use (see
+    // WorkerId in PerWorker.h), so indexes are below the number of threads
+    // calling "run".
+    void run();
+
+    // Causes any calls to "run" to exit, once all queued work items are
+    // executed.
+    void stop();
+
+    // Tells if "run" is executing in the current thread
+    bool canDispatch() {
+        return Callstack<LockFreeWorkQueue>::contains(this) != nullptr;
+    }
+
+private:
+    void pushItem(std::function<void()> w);
+    // Waits until an item is available, and pops it
+    std::function<void()> pop();
+    bool tryPopOverflow(std::function<void()>& w);
+    void runWorker(unsigned index);
+
+    MPMCRing<std::function<void()>> m_ring;
+
+    // Items our own workers pushed while the ring was full. m_overflowSize
+    // lets workers skip the lock while it's empty
+    CacheAligned<std::atomic<size_t>> m_overflowSize{{0}};
+    std::mutex m_overflowMtx;
+    std::deque<std::function<void()>> m_overflow;
+
+    // Parking. Workers register as sleepers before checking the ring one last
+    // time, and pushes only take the lock to wake them up if there are any.
+    CacheAligned<std::atomic<unsigned>> m_sleepers{{0}};
+    std::mutex m_mtx;
+    std::condition_variable m_cond;
+    // Incremented for every wake up, so parked workers can tell if they
+    // missed one
+    uint64_t m_epoch = 0;
+    // Worker indexes in use. Protected by m_mtx
+    std::vector<bool> m_usedIndexes;
+};
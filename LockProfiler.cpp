@@ -0,0 +1,68 @@
+#include "LockProfiler.h"
+#include <algorithm>
+#include <map>
+
+namespace {
+
+struct Registry {
+    std::mutex mtx;
+    std::vector<detail::LockCounters*> live;
+    // Totals of the destroyed instances
+    std::map<std::string, LockStats> retired;
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+void accumulate(LockStats& stats, const detail::LockCounters& c) {
+    stats.acquisitions += c.acquisitions.load(std::memory_order_relaxed);
+    stats.contended += c.contended.load(std::memory_order_relaxed);
+    stats.totalWaitMs += c.totalWaitNs.load(std::memory_order_relaxed) / 1e6;
+    stats.maxWaitMs = std::max(
+        stats.maxWaitMs, c.maxWaitNs.load(std::memory_order_relaxed) / 1e6);
+    stats.totalHoldMs += c.totalHoldNs.load(std::memory_order_relaxed) / 1e6;
+}
+
+}  // namespace
+
+std::vector<LockStats> LockRegistry::snapshot() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    std::map<std::string, LockStats> byName = r.retired;
+    for (auto&& c : r.live) {
+        LockStats& stats = byName[c->name];
+        stats.instances++;
+        accumulate(stats, *c);
+    }
+
+    std::vector<LockStats> res;
+    for (auto&& s : byName) {
+        res.push_back(s.second);
+        res.back().name = s.first;
+    }
+    std::sort(res.begin(), res.end(), [](const LockStats& a, const LockStats& b) {
+        return a.totalWaitMs > b.totalWaitMs;
+    });
+    return res;
+}
+
+void LockRegistry::clearRetired() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    r.retired.clear();
+}
+
+void LockRegistry::add(detail::LockCounters* counters) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    r.live.push_back(counters);
+}
+
+void LockRegistry::remove(detail::LockCounters* counters) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mtx);
+    r.live.erase(std::find(r.live.begin(), r.live.end(), counters));
+    accumulate(r.retired[counters->name], *counters);
+}
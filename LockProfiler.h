@@ -0,0 +1,161 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+// Opt-in lock contention profiling.
+//
+// ProfiledLock<Lock> wraps any lock policy (std::mutex by default), and is
+// given a name when constructed:
+//
+//	Monitor<Routes, ProfiledLock<SpinLock>> routes(Routes(), "routes");
+//	Strand<WorkQueue, ProfiledLock<>> strand(workQueue, "session");
+//
+// When built with CZ_LOCK_PROFILING defined to 1, each instance records its
+// acquisitions, how many were contended, and the time spent waiting and
+// holding the lock, and LockRegistry::snapshot() reports those, aggregated by
+// name (including instances already destroyed).
+// Otherwise ProfiledLock is the wrapped lock itself, ignoring the name, so it
+// costs nothing.
+//
+#ifndef CZ_LOCK_PROFILING
+#define CZ_LOCK_PROFILING 0
+#endif
+
+struct LockStats {
+    std::string name;
+    // Number of instances with this name, currently alive
+    unsigned instances = 0;
+    uint64_t acquisitions = 0;
+    // Acquisitions that had to wait for another thread to release the lock
+    uint64_t contended = 0;
+    double totalWaitMs = 0;
+    double maxWaitMs = 0;
+    double totalHoldMs = 0;
+
+    double contendedRatio() const {
+        return acquisitions ? double(contended) / acquisitions : 0;
+    }
+};
+
+namespace detail {
+
+// Counters of a single lock instance. Only updated by the lock's owner, so
+// they are plain loads and stores, atomic only so snapshots can read them.
+struct LockCounters {
+    explicit LockCounters(std::string name) : name(std::move(name)) {}
+
+    void add(std::atomic<uint64_t>& counter, uint64_t v) {
+        counter.store(counter.load(std::memory_order_relaxed) + v,
+                      std::memory_order_relaxed);
+    }
+
+    std::string name;
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> totalWaitNs{0};
+    std::atomic<uint64_t> maxWaitNs{0};
+    std::atomic<uint64_t> totalHoldNs{0};
+};
+
+template <class Lock>
+class InstrumentedLock {
+public:
+    explicit InstrumentedLock(std::string name = "unnamed");
+    ~InstrumentedLock();
+
+    InstrumentedLock(const InstrumentedLock&) = delete;
+    InstrumentedLock& operator=(const InstrumentedLock&) = delete;
+
+    void lock() {
+        if (m_lock.try_lock()) {
+            m_acquired = Clock::now();
+            m_counters.add(m_counters.acquisitions, 1);
+            return;
+        }
+
+        auto start = Clock::now();
+        m_lock.lock();
+        m_acquired = Clock::now();
+        uint64_t waitNs = toNs(m_acquired - start);
+        m_counters.add(m_counters.acquisitions, 1);
+        m_counters.add(m_counters.contended, 1);
+        m_counters.add(m_counters.totalWaitNs, waitNs);
+        if (waitNs > m_counters.maxWaitNs.load(std::memory_order_relaxed))
+            m_counters.maxWaitNs.store(waitNs, std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        if (!m_lock.try_lock())
+            return false;
+        m_acquired = Clock::now();
+        m_counters.add(m_counters.acquisitions, 1);
+        return true;
+    }
+
+    void unlock() {
+        m_counters.add(m_counters.totalHoldNs,
+                       toNs(Clock::now() - m_acquired));
+        m_lock.unlock();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static uint64_t toNs(Clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    Lock m_lock;
+    Clock::time_point m_acquired;
+    LockCounters m_counters;
+};
+
+// Lock ignoring the name it's given
+template <class Lock>
+class NamedLock : public Lock {
+public:
+    NamedLock() {}
+    explicit NamedLock(const char*) {}
+    explicit NamedLock(const std::string&) {}
+};
+
+}  // namespace detail
+
+#if CZ_LOCK_PROFILING
+template <class Lock = std::mutex>
+using ProfiledLock = detail::InstrumentedLock<Lock>;
+#else
+template <class Lock = std::mutex>
+using ProfiledLock = detail::NamedLock<Lock>;
+#endif
+
+class LockRegistry {
+public:
+    // Stats of all the profiled locks, aggregated by name, and sorted by
+    // total wait time. Empty if profiling is disabled.
+    static std::vector<LockStats> snapshot();
+
+    // Clears the stats of the destroyed instances. The live instances keep
+    // their counters.
+    static void clearRetired();
+
+    // Used by the profiled locks
+    static void add(detail::LockCounters* counters);
+    static void remove(detail::LockCounters* counters);
+};
+
+template <class Lock>
+detail::InstrumentedLock<Lock>::InstrumentedLock(std::string name)
+    : m_counters(std::move(name)) {
+    LockRegistry::add(&m_counters);
+}
+
+template <class Lock>
+detail::InstrumentedLock<Lock>::~InstrumentedLock() {
+    LockRegistry::remove(&m_counters);
+}
@@ -0,0 +1,125 @@
+#include "Monitor.h"
+#include "Locks.h"
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Total lock acquisitions, split between the threads
+const int kOps = 400000;
+// Strand benchmark
+const int kNumObjs = 16;
+const int kHops = 200000;
+const int kStrandThreads = 4;
+
+struct Counter {
+    uint64_t value = 1;
+};
+
+// Critical section of "len" steps of busy work
+inline void criticalSection(Counter& c, int len) {
+    c.value++;
+    for (int i = 0; i < len; i++)
+        c.value = c.value * 6364136223846793005ULL + 1442695040888963407ULL;
+}
+
+// Nanoseconds per acquisition
+template <typename Lock>
+double contended(int numThreads, int len) {
+    Monitor<Counter, Lock> counter;
+    std::vector<std::thread> threads;
+    auto start = nowMs();
+    for (int t = 0; t < numThreads; t++) {
+        threads.push_back(std::thread([&counter, numThreads, len] {
+            for (int i = 0; i < kOps / numThreads; i++)
+                counter([len](Counter& c) { criticalSection(c, len); });
+        }));
+    }
+    for (auto&& t : threads)
+        t.join();
+    return (nowMs() - start) * 1000000 / kOps;
+}
+
+// Strands handing work to each other, which is dominated by the strands'
+// short critical sections. Returns nanoseconds per hop.
+template <typename Lock>
+double strandHops() {
+    struct Obj {
+        explicit Obj(WorkQueue& wq) : strand(wq) {}
+        Strand<WorkQueue, Lock> strand;
+    };
+
+    std::vector<std::unique_ptr<Obj>> objs;
+    WorkQueue workQueue;
+    for (int i = 0; i < kNumObjs; i++)
+        objs.push_back(std::make_unique<Obj>(workQueue));
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kStrandThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+
+    cz::Semaphore finished;
+    std::function<void(int, int)> hop = [&](int obj, int n) {
+        if (n == kHops / kNumObjs) {
+            finished.notify();
+            return;
+        }
+        int next = (obj + 1) % kNumObjs;
+        objs[next]->strand.post([&hop, next, n] { hop(next, n + 1); });
+    };
+
+    auto start = nowMs();
+    for (int i = 0; i < kNumObjs; i++)
+        objs[i]->strand.post([&hop, i] { hop(i, 1); });
+    for (int i = 0; i < kNumObjs; i++)
+        finished.wait();
+    auto elapsed = nowMs() - start;
+
+    workQueue.stop();
+    for (auto&& t : workerThreads)
+        t.join();
+    return elapsed * 1000000 / kHops;
+}
+
+template <typename Lock>
+void runLock(const char* name) {
+    for (int len : {0, 20, 200}) {
+        printf("%-10s cs=%3d:", name, len);
+        for (int numThreads : {1, 2, 4, 8})
+            printf("  %d threads %8.1fns", numThreads,
+                   contended<Lock>(numThreads, len));
+        printf("\n");
+    }
+}
+
+template <typename Lock>
+void runStrand(const char* name) {
+    printf("Strand<WorkQueue, %-10s>: %8.1fns per hop\n", name,
+           strandHops<Lock>());
+}
+
+}  // namespace
+
+void lockSample() {
+    printf("Nanoseconds per acquisition, for critical sections (cs) of "
+           "increasing length\n");
+    runLock<std::mutex>("std::mutex");
+    runLock<SpinLock>("SpinLock");
+    runLock<TicketLock>("TicketLock");
+    runLock<FutexLock>("FutexLock");
+
+    printf("%d strands, %d hops, %d threads\n", kNumObjs, kHops,
+           kStrandThreads);
+    runStrand<std::mutex>("std::mutex");
+    runStrand<SpinLock>("SpinLock");
+    runStrand<TicketLock>("TicketLock");
+    runStrand<FutexLock>("FutexLock");
+}
@@ -0,0 +1,231 @@
+#pragma once
+#include "CacheLine.h"
+#include "Futex.h"
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//
+// Lock policies for Monitor (and anything else taking a BasicLockable), as
+// alternatives to std::mutex for short critical sections:
+//
+// - SpinLock: Test-and-test-and-set spinlock with exponential backoff. The
+// cheapest when contention is low and critical sections are tiny.
+// - TicketLock: Spinlock granting the lock in FIFO order, so no thread
+// starves, at the cost of handing over to threads that might not be running.
+// - FutexLock: Spins for a while, and then sleeps on a futex (see Futex.h).
+// Close to SpinLock when critical sections are short, and doesn't burn CPU
+// when they are long.
+//
+// The spinning locks yield the thread after spinning for a while, so they
+// still make progress when there are more threads than CPUs.
+//
+// ScalableRWLock is a reader-writer lock (SharedLockable) for read-mostly data,
+// where readers don't touch each other's cache lines. It takes a cache line per
+// reader slot (4KB), so it only pays off for heavily shared data.
+//
+
+namespace detail {
+
+// Hints the CPU we are spinning
+inline void cpuRelax() {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+    defined(__x86_64__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Exponential backoff for spin loops, which yields the thread once the
+// backoff reaches its maximum
+class Backoff {
+public:
+    void pause() {
+        if (m_count < kMaxSpins) {
+            for (unsigned i = 0; i < m_count; i++)
+                cpuRelax();
+            m_count *= 2;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    static const unsigned kMaxSpins = 1024;
+    unsigned m_count = 1;
+};
+
+}  // namespace detail
+
+class SpinLock {
+public:
+    SpinLock() {}
+    SpinLock(const SpinLock&) = delete;
+    SpinLock& operator=(const SpinLock&) = delete;
+
+    void lock() {
+        while (m_locked.exchange(true, std::memory_order_acquire)) {
+            // Wait for it to look free before trying again, so waiters only
+            // read the cache line, instead of fighting over it
+            detail::Backoff backoff;
+            while (m_locked.load(std::memory_order_relaxed))
+                backoff.pause();
+        }
+    }
+
+    bool try_lock() {
+        return !m_locked.load(std::memory_order_relaxed) &&
+               !m_locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        m_locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> m_locked{false};
+};
+
+class TicketLock {
+public:
+    TicketLock() {}
+    TicketLock(const TicketLock&) = delete;
+    TicketLock& operator=(const TicketLock&) = delete;
+
+    void lock() {
+        uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+        detail::Backoff backoff;
+        while (m_serving.load(std::memory_order_acquire) != ticket)
+            backoff.pause();
+    }
+
+    bool try_lock() {
+        uint32_t serving = m_serving.load(std::memory_order_relaxed);
+        uint32_t next = serving;
+        return m_next.compare_exchange_strong(next, serving + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        // Only the owner writes it, so no need for a read-modify-write
+        m_serving.store(m_serving.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+    }
+
+private:
+    std::atomic<uint32_t> m_next{0};
+    std::atomic<uint32_t> m_serving{0};
+};
+
+class FutexLock {
+public:
+    FutexLock() {}
+    FutexLock(const FutexLock&) = delete;
+    FutexLock& operator=(const FutexLock&) = delete;
+
+    void lock() {
+        if (try_lock())
+            return;
+
+        // The owner is likely to release it soon
+        for (unsigned i = 0; i < kSpins; i++) {
+            detail::cpuRelax();
+            if (m_state.load(std::memory_order_relaxed) == kUnlocked &&
+                try_lock())
+                return;
+        }
+
+        // Mark it as having waiters, so the owner wakes one up when unlocking.
+        // We might take it with that mark, in which case the next unlock
+        // does an unneeded wake up.
+        while (m_state.exchange(kWaiters, std::memory_order_acquire) !=
+               kUnlocked)
+            futexWait(m_state, kWaiters);
+    }
+
+    bool try_lock() {
+        uint32_t expected = kUnlocked;
+        return m_state.compare_exchange_strong(expected, kLocked,
+                                               std::memory_order_acquire,
+                                               std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        if (m_state.exchange(kUnlocked, std::memory_order_release) == kWaiters)
+            futexWakeOne(m_state);
+    }
+
+private:
+    static const unsigned kSpins = 100;
+    static const uint32_t kUnlocked = 0;
+    static const uint32_t kLocked = 1;
+    static const uint32_t kWaiters = 2;
+    std::atomic<uint32_t> m_state{kUnlocked};
+};
+
+class ScalableRWLock {
+public:
+    ScalableRWLock() {}
+    ScalableRWLock(const ScalableRWLock&) = delete;
+    ScalableRWLock& operator=(const ScalableRWLock&) = delete;
+
+    // Exclusive
+    void lock() {
+        m_writers.lock();
+        // Pairs with the reader's check in "lock_shared": either we see the
+        // reader's count, or the reader sees the flag
+        m_writing.store(true, std::memory_order_seq_cst);
+        for (auto&& slot : m_readers) {
+            detail::Backoff backoff;
+            while (slot.value.load(std::memory_order_seq_cst))
+                backoff.pause();
+        }
+    }
+
+    void unlock() {
+        m_writing.store(false, std::memory_order_release);
+        m_writers.unlock();
+    }
+
+    // Shared. Readers only write to their own slot's cache line, unless a
+    // writer is active.
+    void lock_shared() {
+        std::atomic<uint32_t>& count = readerSlot();
+        while (true) {
+            count.fetch_add(1, std::memory_order_seq_cst);
+            if (!m_writing.load(std::memory_order_seq_cst))
+                return;
+            // Back off, so the writer can proceed
+            count.fetch_sub(1, std::memory_order_relaxed);
+            detail::Backoff backoff;
+            while (m_writing.load(std::memory_order_relaxed))
+                backoff.pause();
+        }
+    }
+
+    void unlock_shared() {
+        readerSlot().fetch_sub(1, std::memory_order_release);
+    }
+
+private:
+    // Threads are spread over the slots, so usually no two readers share a
+    // slot. Sharing a slot only costs scalability.
+    static const unsigned kSlots = 64;
+
+    std::atomic<uint32_t>& readerSlot() {
+        static std::atomic<unsigned> next(0);
+        static thread_local unsigned index = next++ % kSlots;
+        return m_readers[index].value;
+    }
+
+    CacheAligned<std::atomic<uint32_t>> m_readers[kSlots] = {};
+    std::atomic<bool> m_writing{false};
+    FutexLock m_writers;
+};
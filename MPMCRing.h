@@ -0,0 +1,117 @@
+#pragma once
+#include "CacheLine.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <utility>
+
+//
+// Bounded multiple producer / multiple consumer lock-free FIFO queue, based
+// on Dmitry Vyukov's design:
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+//
+// Every cell has a sequence number telling whose turn it is to use the cell:
+// a producer for ticket N waits for sequence N, and a consumer for ticket N
+// waits for sequence N+1. Producers and consumers only contend on their own
+// cursor (one CAS each), and the cursors and cells are kept in separate cache
+// lines.
+//
+template <typename T>
+class MPMCRing {
+public:
+    // "capacity" is rounded up to a power of two
+    explicit MPMCRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_mask = size - 1;
+
+        // Allocate the cells manually, to guarantee the alignment
+        m_mem = new char[sizeof(Cell) * size + kCacheLineSize];
+        uintptr_t p = reinterpret_cast<uintptr_t>(m_mem);
+        m_cells = reinterpret_cast<Cell*>((p + kCacheLineSize - 1) &
+                                          ~uintptr_t(kCacheLineSize - 1));
+        for (size_t i = 0; i < size; i++)
+            new (&m_cells[i]) Cell(i);
+    }
+
+    ~MPMCRing() {
+        T tmp;
+        while (tryPop(tmp)) {
+        }
+        for (size_t i = 0; i <= m_mask; i++)
+            m_cells[i].~Cell();
+        delete[] m_mem;
+    }
+
+    MPMCRing(const MPMCRing&) = delete;
+    MPMCRing& operator=(const MPMCRing&) = delete;
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // Returns false if the queue is full
+    bool tryPush(T& v) {
+        Cell* cell;
+        size_t pos = m_enqueuePos.value.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (m_enqueuePos.value.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // The consumer for the previous lap didn't take it yet
+                return false;
+            } else {
+                pos = m_enqueuePos.value.load(std::memory_order_relaxed);
+            }
+        }
+        new (cell->storage) T(std::move(v));
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool tryPop(T& v) {
+        Cell* cell;
+        size_t pos = m_dequeuePos.value.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff =
+                static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (m_dequeuePos.value.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // The producer didn't fill it yet
+                return false;
+            } else {
+                pos = m_dequeuePos.value.load(std::memory_order_relaxed);
+            }
+        }
+        T* item = reinterpret_cast<T*>(cell->storage);
+        v = std::move(*item);
+        item->~T();
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct alignas(kCacheLineSize) Cell {
+        explicit Cell(size_t seq_) : seq(seq_) {}
+        std::atomic<size_t> seq;
+        alignas(T) char storage[sizeof(T)];
+    };
+
+    CacheAligned<std::atomic<size_t>> m_enqueuePos{{0}};
+    CacheAligned<std::atomic<size_t>> m_dequeuePos{{0}};
+    Cell* m_cells;
+    size_t m_mask;
+    char* m_mem;
+};
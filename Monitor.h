@@ -1,20 +1,27 @@
 #pragma once
 
 #include <mutex>
+#include <utility>
 
-template <class T>
+// "Lock" can be any BasicLockable, such as std::mutex (the default), or one of
+// the policies in Locks.h
+template <class T, class Lock = std::mutex>
 class Monitor {
 private:
     mutable T m_t;
-    mutable std::mutex m_mtx;
+    mutable Lock m_mtx;
 
 public:
     using Type = T;
     Monitor() {}
-    Monitor(T t_) : m_t(std::move(t_)) {}
+    // Any extra arguments are passed to the lock's constructor (e.g: the
+    // name of a ProfiledLock)
+    template <typename... LockArgs>
+    Monitor(T t_, LockArgs&&... lockArgs)
+        : m_t(std::move(t_)), m_mtx(std::forward<LockArgs>(lockArgs)...) {}
     template <typename F>
     auto operator()(F f) const -> decltype(f(m_t)) {
-        std::lock_guard<std::mutex> hold{m_mtx};
+        std::lock_guard<Lock> hold{m_mtx};
         return f(m_t);
     }
 };
@@ -0,0 +1,156 @@
+#include "NumaWorkQueue.h"
+#include "Strand.h"
+#include "Semaphore.h"
+#include "Topology.h"
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int kThreadsPerNode = 2;
+const int kItemsPerNode = 10000;
+
+// Fake "/sys/devices/system/node", with two nodes with CPUs, and a memory
+// only node, which gets no workers
+const char* kSysfsDir = "numa_sysfs.tmp";
+const char* kOnline = "0-2";
+const char* kCpuLists[] = {"0-1,4", "2-3,5", ""};
+const int kNumFakeNodes = 3;
+
+void makeDir(const std::string& path) {
+#if defined(_WIN32)
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+void removeDir(const std::string& path) {
+#if defined(_WIN32)
+    _rmdir(path.c_str());
+#else
+    rmdir(path.c_str());
+#endif
+}
+
+std::string nodeDir(int id) {
+    return std::string(kSysfsDir) + "/node" + std::to_string(id);
+}
+
+void writeFakeSysfs() {
+    makeDir(kSysfsDir);
+    std::ofstream(std::string(kSysfsDir) + "/online") << kOnline << "\n";
+    for (int id = 0; id < kNumFakeNodes; id++) {
+        makeDir(nodeDir(id));
+        std::ofstream(nodeDir(id) + "/cpulist") << kCpuLists[id] << "\n";
+    }
+}
+
+void removeFakeSysfs() {
+    for (int id = 0; id < kNumFakeNodes; id++) {
+        remove((nodeDir(id) + "/cpulist").c_str());
+        removeDir(nodeDir(id));
+    }
+    remove((std::string(kSysfsDir) + "/online").c_str());
+    removeDir(kSysfsDir);
+}
+
+void printTopology(const Topology& topology) {
+    for (auto&& node : topology.nodes) {
+        printf("  node%d: cpus", node.id);
+        for (int cpu : node.cpus)
+            printf(" %d", cpu);
+        printf("\n");
+    }
+}
+
+// Object homed to a node, counting where its handlers execute
+struct Obj {
+    explicit Obj(NumaWorkQueue::Node& node) : node(node), strand(node) {}
+    NumaWorkQueue::Node& node;
+    Strand<NumaWorkQueue::Node> strand;
+    int count = 0;
+    int wrongNode = 0;
+};
+
+}  // namespace
+
+void numaSample() {
+    writeFakeSysfs();
+    Topology topology = Topology::fromSysfs(kSysfsDir);
+    removeFakeSysfs();
+
+    printf("Topology read from %s:\n", kSysfsDir);
+    printTopology(topology);
+    assert(topology.nodes.size() == 2);
+    assert(topology.nodes[0].cpus == std::vector<int>({0, 1, 4}));
+    assert(topology.nodes[1].cpus == std::vector<int>({2, 3, 5}));
+    assert(topology.numCpus() == 6);
+
+    // The fake CPUs might not exist on this machine, so don't pin. Stealing
+    // is disabled, so every item executes on the node it was pushed to.
+    NumaWorkQueue::Options opts;
+    opts.topology = topology;
+    opts.threadsPerNode = kThreadsPerNode;
+    opts.pinning = NumaWorkQueue::Pinning::None;
+    opts.steal = false;
+    NumaWorkQueue queue(opts);
+    assert(queue.numNodes() == 2);
+    assert(!queue.canDispatch());
+
+    std::vector<std::unique_ptr<Obj>> objs;
+    for (size_t i = 0; i < queue.numNodes(); i++)
+        objs.push_back(std::make_unique<Obj>(queue.node(i)));
+
+    // Each node's handlers dispatch to the other node's object, which must
+    // not execute inline on the wrong node
+    std::atomic<int> dispatchedInline{0};
+    cz::Semaphore done;
+    for (int i = 0; i < kItemsPerNode; i++) {
+        for (size_t n = 0; n < objs.size(); n++) {
+            Obj* obj = objs[n].get();
+            Obj* other = objs[(n + 1) % objs.size()].get();
+            obj->strand.post([&, obj, other] {
+                if (queue.currentNode() != &obj->node)
+                    obj->wrongNode++;
+                assert(obj->node.canDispatch());
+                assert(!other->node.canDispatch());
+                other->strand.dispatch([&, obj, other] {
+                    // Still inside obj's handler if executed inline
+                    if (obj->strand.runningInThisThread())
+                        dispatchedInline++;
+                    if (queue.currentNode() != &other->node)
+                        other->wrongNode++;
+                    if (++other->count == kItemsPerNode)
+                        done.notify();
+                });
+            });
+        }
+    }
+    for (size_t n = 0; n < objs.size(); n++)
+        done.wait();
+    queue.stop();
+
+    for (size_t n = 0; n < objs.size(); n++) {
+        printf("node%d: %d handlers dispatched from node%d, %d on the wrong "
+               "node\n",
+               objs[n]->node.info().id, objs[n]->count,
+               objs[(n + objs.size() - 1) % objs.size()]->node.info().id,
+               objs[n]->wrongNode);
+        assert(objs[n]->wrongNode == 0);
+    }
+    printf("Dispatched inline on the wrong node: %d\n", dispatchedInline.load());
+    assert(dispatchedInline == 0);
+}
@@ -0,0 +1,162 @@
+#include "NumaWorkQueue.h"
+#include "PerWorker.h"
+
+NumaWorkQueue::NumaWorkQueue() : NumaWorkQueue(Options()) {}
+
+NumaWorkQueue::NumaWorkQueue(Options opts) : m_steal(opts.steal) {
+    if (opts.topology.nodes.empty())
+        opts.topology = Topology::singleNode();
+
+    for (auto&& info : opts.topology.nodes)
+        m_nodes.push_back(std::unique_ptr<Node>(new Node(*this, info)));
+
+    auto workersPerNode = [&opts](const Node& node) {
+        return opts.threadsPerNode
+                   ? opts.threadsPerNode
+                   : static_cast<unsigned>(node.m_info.cpus.size());
+    };
+    for (auto&& node : m_nodes)
+        m_numWorkers += workersPerNode(*node);
+
+    for (auto&& node : m_nodes) {
+        const std::vector<int>& cpus = node->m_info.cpus;
+        unsigned count = workersPerNode(*node);
+        for (unsigned i = 0; i < count; i++) {
+            std::vector<int> pinTo;
+            if (opts.pinning == Pinning::Node)
+                pinTo = cpus;
+            else if (opts.pinning == Pinning::Cpu && cpus.size())
+                pinTo.push_back(cpus[i % cpus.size()]);
+            Node* n = node.get();
+            unsigned index = static_cast<unsigned>(m_threads.size());
+            m_threads.push_back(std::thread([this, n, index, pinTo] {
+                workerMain(*n, index, std::move(pinTo));
+            }));
+        }
+    }
+}
+
+NumaWorkQueue::~NumaWorkQueue() {
+    stop();
+}
+
+void NumaWorkQueue::pushToNode(Node& node, std::function<void()> w) {
+    node.m_pushed.value++;
+    bool nodeBusy;
+    {
+        std::lock_guard<std::mutex> lock(node.m_mtx);
+        node.m_q.push_back(std::move(w));
+        nodeBusy = node.m_idle == 0;
+        if (!nodeBusy)
+            node.m_cond.notify_one();
+    }
+
+    // All the node's workers are busy, so wake up an idle worker from another
+    // node to help
+    if (nodeBusy && m_steal) {
+        for (auto&& other : m_nodes) {
+            if (other.get() == &node)
+                continue;
+            std::lock_guard<std::mutex> lock(other->m_mtx);
+            if (other->m_idle) {
+                other->m_cond.notify_one();
+                break;
+            }
+        }
+    }
+}
+
+bool NumaWorkQueue::trySteal(Node& thief, std::function<void()>& w) {
+    for (auto&& victim : m_nodes) {
+        if (victim.get() == &thief)
+            continue;
+        // Don't wait for busy nodes
+        std::unique_lock<std::mutex> lock(victim->m_mtx, std::try_to_lock);
+        if (lock && victim->m_q.size()) {
+            w = std::move(victim->m_q.front());
+            victim->m_q.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void NumaWorkQueue::workerMain(Node& node, unsigned index,
+                               std::vector<int> cpus) {
+    if (cpus.size())
+        pinCurrentThread(cpus);
+
+    Callstack<NumaWorkQueue, Node>::Context ctx(this, node);
+    WorkerId::Scope workerId(index);
+    std::unique_lock<std::mutex> lock(node.m_mtx);
+    while (true) {
+        if (node.m_q.size()) {
+            std::function<void()> w = std::move(node.m_q.front());
+            node.m_q.pop_front();
+            lock.unlock();
+            w();
+            finishedItem(node);
+            lock.lock();
+            continue;
+        }
+
+        // Our node is idle, so try to help other nodes
+        if (m_steal) {
+            lock.unlock();
+            std::function<void()> w;
+            bool stolen = trySteal(node, w);
+            if (stolen) {
+                w();
+                finishedItem(node);
+            }
+            lock.lock();
+            if (stolen || node.m_q.size())
+                continue;
+        }
+
+        if (m_stopping && drained())
+            return;
+
+        node.m_idle++;
+        node.m_cond.wait(lock);
+        node.m_idle--;
+    }
+}
+
+void NumaWorkQueue::finishedItem(Node& node) {
+    node.m_finished.value++;
+    // The last item while stopping lets the workers of every node exit
+    if (m_stopping && drained()) {
+        for (auto&& node : m_nodes) {
+            std::lock_guard<std::mutex> lock(node->m_mtx);
+            node->m_cond.notify_all();
+        }
+    }
+}
+
+bool NumaWorkQueue::drained() const {
+    // Items are counted as pushed before they are queued, and as finished
+    // after they execute, so if all the finished counts (read first) match
+    // the pushed counts (read after), nothing was queued or executing in
+    // between.
+    uint64_t finished = 0;
+    uint64_t pushed = 0;
+    for (auto&& node : m_nodes)
+        finished += node->m_finished.value;
+    for (auto&& node : m_nodes)
+        pushed += node->m_pushed.value;
+    return finished == pushed;
+}
+
+void NumaWorkQueue::stop() {
+    m_stopping = true;
+    for (auto&& node : m_nodes) {
+        std::lock_guard<std::mutex> lock(node->m_mtx);
+        node->m_cond.notify_all();
+    }
+
+    for (auto&& t : m_threads) {
+        if (t.joinable())
+            t.join();
+    }
+}
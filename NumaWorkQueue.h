@@ -0,0 +1,166 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CacheLine.h"
+#include "Callstack.h"
+#include "Continuation.h"
+#include "Topology.h"
+
+//
+// Multiple producer / Multiple consumer work queue, with a group of worker
+// threads per NUMA node.
+//
+// Each node has its own queue, and its workers are pinned to the node's CPUs,
+// so work pushed to a node runs close to the memory that node's workers
+// allocated. Workers only take work from other nodes when their own node's
+// queue is empty.
+//
+// A Strand can be homed to a node by using the node as its Processor:
+//
+//	Strand<NumaWorkQueue::Node> strand(numaQueue.node(0));
+//
+class NumaWorkQueue {
+public:
+    enum class Pinning {
+        // Workers are not pinned
+        None,
+        // Each worker is pinned to all the CPUs of its node
+        Node,
+        // Each worker is pinned to a single CPU of its node
+        Cpu
+    };
+
+    struct Options {
+        Topology topology = Topology::discover();
+        // Number of workers per node. If 0, it creates one worker per CPU
+        unsigned threadsPerNode = 0;
+        Pinning pinning = Pinning::Node;
+        // If true, workers execute work from other nodes when their own node
+        // is idle.
+        bool steal = true;
+    };
+
+    // A node's queue. It implements the Processor interface, so work pushed
+    // here is executed by that node's workers (unless stolen by idle workers
+    // from other nodes).
+    class Node {
+    public:
+        Node(const Node&) = delete;
+        Node& operator=(const Node&) = delete;
+
+        // If the work item returns a Continuation, it's pushed to this node
+        // again once the item returns
+        template <typename F>
+        void push(F w) {
+            m_owner.pushToNode(*this, detail::repushing(*this, std::move(w)));
+        }
+
+        // Only true for this node's workers (even if they are executing work
+        // stolen from another node), so work homed to this node is never
+        // dispatched inline on another node
+        bool canDispatch() {
+            return m_owner.currentNode() == this;
+        }
+
+        const NumaNode& info() const {
+            return m_info;
+        }
+
+    private:
+        friend class NumaWorkQueue;
+        Node(NumaWorkQueue& owner, NumaNode info)
+            : m_owner(owner), m_info(std::move(info)) {}
+
+        NumaWorkQueue& m_owner;
+        NumaNode m_info;
+        std::mutex m_mtx;
+        std::condition_variable m_cond;
+        std::deque<std::function<void()>> m_q;
+        // Number of workers waiting for work in this node
+        int m_idle = 0;
+
+        // Items pushed to this node, and items this node's workers executed
+        // (including stolen ones), so "stop" can tell when all nodes are done.
+        // Kept per node, and apart, so counting doesn't bounce a cache line
+        // between nodes.
+        CacheAligned<std::atomic<uint64_t>> m_pushed{{0}};
+        CacheAligned<std::atomic<uint64_t>> m_finished{{0}};
+    };
+
+    // Creates and starts the workers, with the default options
+    NumaWorkQueue();
+    explicit NumaWorkQueue(Options opts);
+    ~NumaWorkQueue();
+
+    NumaWorkQueue(const NumaWorkQueue&) = delete;
+    NumaWorkQueue& operator=(const NumaWorkQueue&) = delete;
+
+    // Add a new work item to the current thread's node if called from a
+    // worker, or to the nodes in a round-robin fashion otherwise.
+    // If it returns a Continuation, it's pushed to the node that executed it.
+    template <typename F>
+    void push(F w) {
+        Node* node = currentNode();
+        if (!node)
+            node = m_nodes[m_next++ % m_nodes.size()].get();
+        node->push(std::move(w));
+    }
+
+    // Tells if a worker of this queue is executing in the current thread
+    bool canDispatch() {
+        return currentNode() != nullptr;
+    }
+
+    // Node of the worker executing in the current thread, or nullptr if not
+    // called from a worker
+    Node* currentNode() {
+        return Callstack<NumaWorkQueue, Node>::contains(this);
+    }
+
+    size_t numNodes() const {
+        return m_nodes.size();
+    }
+
+    // Number of workers, across all nodes. Workers are numbered in node order
+    // (see WorkerId in PerWorker.h)
+    unsigned numWorkers() const {
+        return m_numWorkers;
+    }
+
+    Node& node(size_t index) {
+        return *m_nodes[index];
+    }
+
+    // Causes all workers to exit once all queued work items (including any
+    // they push meanwhile, to any node) are executed, and waits for them to
+    // finish.
+    // Must not be called from a worker.
+    void stop();
+
+private:
+    void pushToNode(Node& node, std::function<void()> w);
+    void workerMain(Node& node, unsigned index, std::vector<int> cpus);
+    // Called once a worker of "node" executed an item
+    void finishedItem(Node& node);
+    // Tells if every item pushed to any node was executed
+    bool drained() const;
+    // Takes a work item from a node other than "thief"
+    bool trySteal(Node& thief, std::function<void()>& w);
+
+    std::vector<std::unique_ptr<Node>> m_nodes;
+    std::vector<std::thread> m_threads;
+    // Set before any worker starts, since workers can call numWorkers
+    unsigned m_numWorkers = 0;
+    std::atomic<unsigned> m_next{0};
+    // Once stopping, workers only exit when all nodes are drained, since
+    // items executing in any node might still push more work to ours
+    std::atomic<bool> m_stopping{false};
+    bool m_steal;
+};
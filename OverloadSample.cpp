@@ -0,0 +1,130 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 2;
+// Time a worker spends on each request, and time the client waits for the
+// response before giving up
+const double kCostMs = 0.1;
+const double kTimeoutMs = 10;
+// Offered load, as a multiple of what the workers can handle
+const double kOverload = 2;
+const double kDurationMs = 500;
+
+enum class Mode { NoShedding, Shedding, SheddingEdf };
+
+const char* toString(Mode mode) {
+    switch (mode) {
+    case Mode::NoShedding: return "No shedding";
+    case Mode::Shedding: return "Shedding";
+    case Mode::SheddingEdf: return "Shedding + EDF";
+    }
+    return "";
+}
+
+void busyMs(double ms) {
+    auto end = nowMs() + ms;
+    while (nowMs() < end) {
+    }
+}
+
+struct Counters {
+    std::atomic<int> pushed{0};
+    // Requests executed, executed before the client gave up, or skipped
+    std::atomic<int> executed{0};
+    std::atomic<int> good{0};
+    std::atomic<int> shed{0};
+    // Strand handlers (pushed to the queue without a deadline) posted and
+    // executed, and the longest they waited
+    int ticks = 0;
+    std::atomic<int> ticksDone{0};
+    double maxTickDelayMs = 0;
+};
+
+void run(Mode mode) {
+    WorkQueue workQueue;
+    workQueue.setDeadlineOrdering(mode == Mode::SheddingEdf);
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+
+    Counters c;
+    // Background work, posted every millisecond along with the requests
+    Strand<WorkQueue> strand(workQueue);
+    // Requests per millisecond. Clients use random timeouts around
+    // kTimeoutMs, so the deadline order differs from the arrival order.
+    const int perMs = static_cast<int>(kNumThreads / kCostMs * kOverload);
+    auto start = nowMs();
+    for (int tick = 0; nowMs() - start < kDurationMs; tick++) {
+        for (int i = 0; i < perMs; i++) {
+            double created = nowMs();
+            double timeoutMs = kTimeoutMs / 2 + random_at_most(100) *
+                                                    kTimeoutMs / 100;
+            auto handler = [&c, created, timeoutMs] {
+                busyMs(kCostMs);
+                c.executed++;
+                if (nowMs() - created <= timeoutMs)
+                    c.good++;
+            };
+            c.pushed++;
+            if (mode == Mode::NoShedding) {
+                workQueue.push(handler);
+            } else {
+                // Starting after this means finishing too late
+                workQueue.push(handler, Deadline::in(timeoutMs - kCostMs,
+                                                     [&c] { c.shed++; }));
+            }
+        }
+        double posted = nowMs();
+        c.ticks++;
+        strand.post([&c, posted] {
+            c.maxTickDelayMs = std::max(c.maxTickDelayMs, nowMs() - posted);
+            c.ticksDone++;
+        });
+        while (nowMs() - start < tick + 1)
+            std::this_thread::yield();
+    }
+    auto offeredMs = nowMs() - start;
+
+    while (c.executed + c.shed != c.pushed || c.ticksDone != c.ticks)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    auto elapsed = nowMs() - start;
+
+    auto stats = workQueue.stats()[Priority::Normal];
+    printf("%-15s: %6d requests, %6d executed (%6d late), %6d shed, goodput "
+           "%7.0f/s, drained after %7.2fms\n",
+           toString(mode), c.pushed.load(), c.executed.load(),
+           c.executed - c.good, c.shed.load(), c.good * 1000 / offeredMs,
+           elapsed);
+    printf("%-15s  strand handlers: %d, waited up to %.2fms\n", "",
+           c.ticks, c.maxTickDelayMs);
+    assert(stats.expired == static_cast<uint64_t>(c.shed));
+    // Without shedding, the strand waits behind the growing backlog like
+    // everything else. Otherwise, requests (even ordered by deadline) can't
+    // starve it for the whole overload.
+    assert(mode == Mode::NoShedding || c.maxTickDelayMs < kDurationMs / 2);
+    (void)stats;
+
+    workQueue.stop();
+    for (auto&& t : workerThreads)
+        t.join();
+}
+
+}  // namespace
+
+void overloadSample() {
+    printf("%d threads, %.2fms per request, ~%.0fms timeouts, offered load "
+           "%.0fx capacity for %.0fms\n",
+           kNumThreads, kCostMs, kTimeoutMs, kOverload, kDurationMs);
+    run(Mode::NoShedding);
+    run(Mode::Shedding);
+    run(Mode::SheddingEdf);
+}
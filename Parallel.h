@@ -0,0 +1,166 @@
+#pragma once
+#include "TaskGroup.h"
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//
+// Data parallel loops over a Processor's workers (see Strand.h for the
+// Processor interface).
+//
+// The range is divided in blocks of "grain" elements, which a single task
+// starts working through in order. Whenever no task is waiting to be picked up
+// (meaning workers are likely idle), a running task splits off the upper half
+// of its remaining blocks as a new task (in a TaskGroup). Idle workers pick up
+// big pieces of work first, and the range is only divided as much as the load
+// requires, which adapts to elements (or workers) being slower than others.
+// If "grain" is 0, it's picked from the range size and the Processor's number
+// of workers (its "numWorkers()", or the number of hardware threads if it
+// doesn't have one), giving every worker many blocks to balance with.
+//
+// Both calls return when the whole range is processed, and rethrow the first
+// exception thrown by "f". When called from a worker, the caller processes
+// blocks too, instead of just waiting.
+//
+
+namespace detail {
+
+// Blocks per worker, if the grain is picked automatically
+const size_t kBlocksPerWorker = 16;
+
+// Number of workers of the Processor, if it has a "numWorkers()", or the number
+// of hardware threads otherwise
+template <typename Processor>
+auto numWorkers(Processor& proc, int) -> decltype(unsigned(proc.numWorkers())) {
+    return proc.numWorkers();
+}
+
+template <typename Processor>
+unsigned numWorkers(Processor&, long) {
+    return std::thread::hardware_concurrency();
+}
+
+template <typename Processor>
+size_t autoGrain(Processor& proc, size_t size) {
+    size_t blocks = std::max(numWorkers(proc, 0), 1u) * kBlocksPerWorker;
+    return std::max((size + blocks - 1) / blocks, size_t(1));
+}
+
+// Executes "body(block)" for blocks [0, count) in the processor, splitting the
+// range as workers ask for work, and waits for them to finish. From outside
+// the processor, the caller just waits.
+template <typename Processor, typename Body>
+class LazySplitter {
+public:
+    LazySplitter(Processor& proc, const Body& body)
+        : m_group(proc), m_body(body) {}
+
+    void run(Processor& proc, size_t count) {
+        if (proc.canDispatch())
+            runBlocks(0, count);
+        else
+            spawn(0, count);
+        m_group.wait();
+    }
+
+private:
+    void spawn(size_t begin, size_t end) {
+        m_unclaimed.fetch_add(1, std::memory_order_relaxed);
+        m_group.spawn([this, begin, end] {
+            m_unclaimed.fetch_sub(1, std::memory_order_relaxed);
+            runBlocks(begin, end);
+        });
+    }
+
+    void runBlocks(size_t begin, size_t end) {
+        while (begin < end && !m_failed.load(std::memory_order_relaxed)) {
+            if (end - begin > 1 &&
+                m_unclaimed.load(std::memory_order_relaxed) == 0) {
+                size_t mid = begin + (end - begin) / 2;
+                spawn(mid, end);
+                end = mid;
+                continue;
+            }
+            try {
+                m_body(begin++);
+            } catch (...) {
+                // Stop the other tasks too. The group rethrows the exception.
+                m_failed = true;
+                throw;
+            }
+        }
+    }
+
+    TaskGroup<Processor> m_group;
+    const Body& m_body;
+    // Spawned tasks not started yet
+    std::atomic<size_t> m_unclaimed{0};
+    std::atomic<bool> m_failed{false};
+};
+
+template <typename Processor, typename Body>
+void runBlocks(Processor& proc, size_t count, const Body& body) {
+    LazySplitter<Processor, Body>(proc, body).run(proc, count);
+}
+
+}  // namespace detail
+
+// Calls "f(i)" for every "i" in [begin, end)
+template <typename Processor, typename Index, typename F>
+void parallelFor(Processor& proc, Index begin, Index end, const F& f,
+                 size_t grain = 0) {
+    if (!(begin < end))
+        return;
+    size_t size = static_cast<size_t>(end - begin);
+    if (grain == 0)
+        grain = detail::autoGrain(proc, size);
+    size_t blocks = (size + grain - 1) / grain;
+
+    auto body = [&](size_t block) {
+        Index first = begin + static_cast<Index>(block * grain);
+        Index last = begin + static_cast<Index>(
+                                 std::min((block + 1) * grain, size));
+        for (Index i = first; i != last; ++i)
+            f(i);
+    };
+
+    detail::runBlocks(proc, blocks, body);
+}
+
+// Folds every "i" in [begin, end) into an accumulator with "acc = f(acc, i)",
+// starting from "identity" in every block, and combines the blocks' results
+// with "reduce(a, b)".
+// Results are combined in the range's order, and the blocks don't depend on
+// how the range was split, so "reduce" only needs to be associative, and the
+// result is the same from run to run.
+template <typename Processor, typename Index, typename T, typename F,
+          typename R>
+T parallelReduce(Processor& proc, Index begin, Index end, T identity,
+                 const F& f, const R& reduce, size_t grain = 0) {
+    if (!(begin < end))
+        return identity;
+    size_t size = static_cast<size_t>(end - begin);
+    if (grain == 0)
+        grain = detail::autoGrain(proc, size);
+    size_t blocks = (size + grain - 1) / grain;
+
+    std::vector<T> partials(blocks, identity);
+    auto body = [&](size_t block) {
+        Index first = begin + static_cast<Index>(block * grain);
+        Index last = begin + static_cast<Index>(
+                                 std::min((block + 1) * grain, size));
+        T acc = identity;
+        for (Index i = first; i != last; ++i)
+            acc = f(std::move(acc), i);
+        partials[block] = std::move(acc);
+    };
+
+    detail::runBlocks(proc, blocks, body);
+
+    T res = std::move(partials[0]);
+    for (size_t i = 1; i < blocks; i++)
+        res = reduce(std::move(res), std::move(partials[i]));
+    return res;
+}
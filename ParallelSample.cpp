@@ -0,0 +1,121 @@
+#include "Parallel.h"
+#include "WorkQueue.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t kSize = 10000000;
+const int kRuns = 10;
+
+// Light per element work
+inline float transform(float v) {
+    return sqrtf(v) * 0.5f + 1.0f;
+}
+
+// Splits the range evenly across new threads, the usual hand-rolled way
+template <typename F>
+void threadSplit(unsigned numThreads, size_t size, const F& f) {
+    std::vector<std::thread> threads;
+    size_t chunk = (size + numThreads - 1) / numThreads;
+    for (unsigned t = 0; t < numThreads; t++) {
+        size_t first = std::min(t * chunk, size);
+        size_t last = std::min(first + chunk, size);
+        threads.push_back(std::thread([&f, t, first, last] { f(t, first, last); }));
+    }
+    for (auto&& t : threads)
+        t.join();
+}
+
+// Best time out of kRuns
+template <typename F>
+double bestMs(const F& f) {
+    double best = 1e9;
+    for (int i = 0; i < kRuns; i++) {
+        auto start = nowMs();
+        f();
+        best = std::min(best, nowMs() - start);
+    }
+    return best;
+}
+
+}  // namespace
+
+void parallelSample() {
+    unsigned numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (unsigned i = 0; i < numThreads; i++) {
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    }
+
+    std::vector<float> in(kSize), out(kSize);
+    for (size_t i = 0; i < kSize; i++)
+        in[i] = static_cast<float>(i % 1000);
+
+    printf("%d elements, %u threads, best of %d runs\n",
+           static_cast<int>(kSize), numThreads, kRuns);
+
+    double ms = bestMs([&] {
+        for (size_t i = 0; i < kSize; i++)
+            out[i] = transform(in[i]);
+    });
+    printf("for    : serial %6.2fms", ms);
+
+    ms = bestMs([&] {
+        threadSplit(numThreads, kSize, [&](unsigned, size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                out[i] = transform(in[i]);
+        });
+    });
+    printf(", std::thread split %6.2fms", ms);
+
+    ms = bestMs([&] {
+        parallelFor(workQueue, size_t(0), kSize,
+                    [&](size_t i) { out[i] = transform(in[i]); });
+    });
+    printf(", parallelFor %6.2fms\n", ms);
+
+    double expected = 0;
+    ms = bestMs([&] {
+        expected = 0;
+        for (size_t i = 0; i < kSize; i++)
+            expected += transform(in[i]);
+    });
+    printf("reduce : serial %6.2fms", ms);
+
+    double sum = 0;
+    ms = bestMs([&] {
+        std::vector<double> partials(numThreads);
+        threadSplit(numThreads, kSize, [&](unsigned t, size_t first, size_t last) {
+            double acc = 0;
+            for (size_t i = first; i < last; i++)
+                acc += transform(in[i]);
+            partials[t] = acc;
+        });
+        sum = 0;
+        for (double p : partials)
+            sum += p;
+    });
+    printf(", std::thread split %6.2fms", ms);
+    assert(fabs(sum - expected) < 1e-6 * expected);
+
+    ms = bestMs([&] {
+        sum = parallelReduce(
+            workQueue, size_t(0), kSize, 0.0,
+            [&](double acc, size_t i) { return acc + transform(in[i]); },
+            [](double a, double b) { return a + b; });
+    });
+    printf(", parallelReduce %6.2fms\n", ms);
+    assert(fabs(sum - expected) < 1e-6 * expected);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads) {
+        t.join();
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "CacheLine.h"
+#include <assert.h>
+#include <utility>
+#include <vector>
+
+//
+// Index of the worker executing in the current thread, as assigned by its
+// executor. Kept in a thread local, so looking it up is O(1).
+// All the executors set it for their workers, with indexes below their number
+// of workers:
+//	- WorkQueue: the same index as "WorkQueue::workerIndex"
+//	- LockFreeWorkQueue: the lowest index not in use by another "run" call
+//	- NumaWorkQueue: workers numbered in node order
+//	- ShardedExecutor: the shard's index
+//
+class WorkerId {
+public:
+    // -1 if the current thread is not a worker
+    static int current() {
+        return slot();
+    }
+
+    // Sets the current thread's worker index, for the lifetime of the scope
+    class Scope {
+    public:
+        explicit Scope(unsigned index) : m_prev(slot()) {
+            slot() = static_cast<int>(index);
+        }
+        ~Scope() {
+            slot() = m_prev;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        int m_prev;
+    };
+
+private:
+    static int& slot() {
+        static thread_local int index = -1;
+        return index;
+    }
+};
+
+//
+// One T per worker, each in its own cache line(s), so workers can update
+// their own slot (e.g: counters in a hot path) without any synchronization or
+// false sharing:
+//
+//	PerWorker<Stats> stats(maxWorkers);
+//	// In a worker
+//	stats.local().processed++;
+//	// Once the workers are idle
+//	auto total = stats.combine(0, [](uint64_t acc, const Stats& s) {
+//		return acc + s.processed;
+//	});
+//
+// Slots are plain T, so reading them while workers update them is a data
+// race. Either combine once the workers are quiescent, or use a T made of
+// relaxed atomics.
+//
+template <typename T>
+class PerWorker {
+public:
+    explicit PerWorker(unsigned numSlots) : m_slots(numSlots) {}
+
+    PerWorker(const PerWorker&) = delete;
+    PerWorker& operator=(const PerWorker&) = delete;
+
+    // Slot of the worker executing in the current thread, which must have an
+    // index below "size"
+    T& local() {
+        int index = WorkerId::current();
+        assert(index >= 0 && static_cast<unsigned>(index) < m_slots.size());
+        return m_slots[index].value;
+    }
+
+    T& operator[](unsigned index) {
+        return m_slots[index].value;
+    }
+    const T& operator[](unsigned index) const {
+        return m_slots[index].value;
+    }
+
+    unsigned size() const {
+        return static_cast<unsigned>(m_slots.size());
+    }
+
+    // Folds all the slots with "f(acc, const T&)", starting with "init"
+    template <typename R, typename F>
+    R combine(R init, F f) const {
+        for (auto&& slot : m_slots)
+            init = f(std::move(init), slot.value);
+        return init;
+    }
+
+private:
+    std::vector<CacheAligned<T>> m_slots;
+};
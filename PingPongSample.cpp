@@ -0,0 +1,143 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 4;
+const int kRoundTrips = 20000;
+// Per object state touched by every message, so it matters whether the
+// handler runs where that state is still cached
+const size_t kStateSize = 1024;
+// How long a handler blocks after pushing a continuation, in "stuckSlot"
+const double kBlockMs = 50;
+
+// Object exchanging requests/responses with its peer, through their strands
+struct Peer {
+    explicit Peer(WorkQueue& wq) : strand(wq), state(kStateSize) {}
+
+    void onMessage(int n) {
+        uint64_t sum = 0;
+        for (auto&& v : state) {
+            v += n;
+            sum += v;
+        }
+        checksum += sum;
+
+        if (n == kRoundTrips * 2) {
+            done->notify();
+            return;
+        }
+        Peer* p = other;
+        p->strand.post([p, n] { p->onMessage(n + 1); });
+    }
+
+    Strand<WorkQueue> strand;
+    std::vector<uint64_t> state;
+    uint64_t checksum = 0;
+    Peer* other = nullptr;
+    cz::Semaphore* done = nullptr;
+};
+
+void run(int numPairs, bool lifo) {
+    WorkQueue workQueue;
+    workQueue.setLifoSlot(lifo);
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++) {
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    }
+
+    cz::Semaphore done;
+    std::vector<std::unique_ptr<Peer>> peers;
+    for (int i = 0; i < numPairs * 2; i++) {
+        peers.push_back(std::make_unique<Peer>(workQueue));
+        peers.back()->done = &done;
+    }
+    for (int i = 0; i < numPairs; i++) {
+        peers[i * 2]->other = peers[i * 2 + 1].get();
+        peers[i * 2 + 1]->other = peers[i * 2].get();
+    }
+
+    auto start = nowMs();
+    for (int i = 0; i < numPairs; i++) {
+        Peer* p = peers[i * 2].get();
+        p->strand.post([p] { p->onMessage(1); });
+    }
+    for (int i = 0; i < numPairs; i++)
+        done.wait();
+    auto elapsed = nowMs() - start;
+
+    double hops = double(numPairs) * kRoundTrips * 2;
+    auto stats = workQueue.stats()[Priority::Normal];
+    printf("%2d pairs, LIFO slot %-3s: %8.2fms, %6.3fus per message, queue "
+           "delay avg=%6.3fms\n",
+           numPairs, lifo ? "on" : "off", elapsed, elapsed * 1000 / hops,
+           stats.avgDelayMs());
+
+    workQueue.stop();
+    for (auto&& t : workerThreads) {
+        t.join();
+    }
+}
+
+// A handler pushes a continuation to its LIFO slot, and then blocks. The
+// continuation should be taken over by the idle worker, instead of waiting
+// for the handler to finish.
+void stuckSlot() {
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < 2; i++) {
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    }
+
+    cz::Semaphore done;
+    int handlerWorker = -1;
+    int continuationWorker = -1;
+    double pushedMs = 0;
+    double delayMs = 0;
+    workQueue.push([&] {
+        handlerWorker = workQueue.workerIndex();
+        // Give the other worker time to go to sleep
+        std::this_thread::sleep_for(
+            std::chrono::duration<double, std::milli>(kBlockMs / 5));
+        pushedMs = nowMs();
+        workQueue.push([&] {
+            continuationWorker = workQueue.workerIndex();
+            delayMs = nowMs() - pushedMs;
+            done.notify();
+        });
+        std::this_thread::sleep_for(
+            std::chrono::duration<double, std::milli>(kBlockMs));
+    });
+    done.wait();
+
+    printf("Continuation of a blocked handler: executed after %.2fms, by the "
+           "%s worker\n",
+           delayMs,
+           continuationWorker == handlerWorker ? "same" : "idle");
+    assert(continuationWorker != handlerWorker && delayMs < kBlockMs);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads) {
+        t.join();
+    }
+}
+
+}  // namespace
+
+void pingPongSample() {
+    printf("%d threads, %d round trips per pair\n", kNumThreads, kRoundTrips);
+    for (int numPairs : {1, kNumThreads, kNumThreads * 4}) {
+        run(numPairs, false);
+        run(numPairs, true);
+    }
+    stuckSlot();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <utility>
+
+//
+// Scheduling priority of a work item.
+// Processors that support priorities pick higher priority items first, but
+// are expected to give lower priorities some share of the workers, so they
+// never starve.
+//
+enum class Priority { Low = 0, Normal = 1, High = 2 };
+static const int kNumPriorities = 3;
+
+namespace detail {
+
+// Pushes a work item to a Processor with the specified priority, if the
+// Processor supports priorities (has a "push(F, Priority)"), or with a plain
+// "push(F)" otherwise.
+template <typename Processor, typename F>
+auto pushWithPriority(Processor& proc, F&& w, Priority prio, int)
+    -> decltype(proc.push(std::forward<F>(w), prio), void()) {
+    proc.push(std::forward<F>(w), prio);
+}
+
+template <typename Processor, typename F>
+void pushWithPriority(Processor& proc, F&& w, Priority, long) {
+    proc.push(std::forward<F>(w));
+}
+
+template <typename Processor, typename F>
+void pushWithPriority(Processor& proc, F&& w, Priority prio) {
+    pushWithPriority(proc, std::forward<F>(w), prio, 0);
+}
+
+// Same as "pushWithPriority", but uses the Processor's "defer(F, Priority)"
+// if it has one, so the work item goes behind anything already queued.
+template <typename Processor, typename F>
+auto deferWithPriority(Processor& proc, F&& w, Priority prio, int)
+    -> decltype(proc.defer(std::forward<F>(w), prio), void()) {
+    proc.defer(std::forward<F>(w), prio);
+}
+
+template <typename Processor, typename F>
+void deferWithPriority(Processor& proc, F&& w, Priority prio, long) {
+    pushWithPriority(proc, std::forward<F>(w), prio);
+}
+
+template <typename Processor, typename F>
+void deferWithPriority(Processor& proc, F&& w, Priority prio) {
+    deferWithPriority(proc, std::forward<F>(w), prio, 0);
+}
+
+// Hands a work item to an executor: "post" for a Strand (or anything else
+// with a "post(F)"), or "push" for a Processor.
+template <typename Executor, typename F>
+auto postTo(Executor& ex, F&& w, int)
+    -> decltype(ex.post(std::forward<F>(w)), void()) {
+    ex.post(std::forward<F>(w));
+}
+
+template <typename Executor, typename F>
+void postTo(Executor& ex, F&& w, long) {
+    ex.push(std::forward<F>(w));
+}
+
+template <typename Executor, typename F>
+void postTo(Executor& ex, F&& w) {
+    postTo(ex, std::forward<F>(w), 0);
+}
+
+}  // namespace detail
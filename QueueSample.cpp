@@ -0,0 +1,145 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "LockFreeWorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kItems = 1000000;
+
+template <typename Queue>
+struct Workers {
+    explicit Workers(Queue& q, int count) : q(q) {
+        for (int i = 0; i < count; i++)
+            threads.push_back(std::thread([&q] { q.run(); }));
+    }
+    ~Workers() {
+        q.stop();
+        for (auto&& t : threads)
+            t.join();
+    }
+    Queue& q;
+    std::vector<std::thread> threads;
+};
+
+// Producers pushing tiny items as fast as they can, to as many consumers
+template <typename Queue>
+double producersConsumers(Queue& q, int numThreads) {
+    Workers<Queue> workers(q, numThreads);
+    std::atomic<int> done(0);
+    cz::Semaphore finished;
+    int perProducer = kItems / numThreads;
+    int total = perProducer * numThreads;
+
+    auto start = nowMs();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numThreads; p++) {
+        producers.push_back(std::thread([&] {
+            for (int i = 0; i < perProducer; i++) {
+                q.push([&] {
+                    if (++done == total)
+                        finished.notify();
+                });
+            }
+        }));
+    }
+    for (auto&& t : producers)
+        t.join();
+    finished.wait();
+    return nowMs() - start;
+}
+
+// Strands handing work to each other, so the workers are both the producers
+// and the consumers
+template <typename Queue>
+double strands(Queue& q, int numThreads) {
+    struct Obj {
+        explicit Obj(Queue& q) : strand(q) {}
+        Strand<Queue> strand;
+        int count = 0;
+    };
+
+    const int numObjs = 16;
+    std::vector<std::unique_ptr<Obj>> objs;
+    for (int i = 0; i < numObjs; i++)
+        objs.push_back(std::make_unique<Obj>(q));
+    // Declared after the objects, so it stops the workers before the strands
+    // are destroyed
+    Workers<Queue> workers(q, numThreads);
+
+    cz::Semaphore finished;
+    std::function<void(int, int)> hop = [&](int obj, int n) {
+        objs[obj]->count++;
+        if (n == kItems / numObjs) {
+            finished.notify();
+            return;
+        }
+        int next = (obj + 1) % numObjs;
+        objs[next]->strand.post([&hop, next, n] { hop(next, n + 1); });
+    };
+
+    auto start = nowMs();
+    for (int i = 0; i < numObjs; i++)
+        objs[i]->strand.post([&hop, i] { hop(i, 1); });
+    for (int i = 0; i < numObjs; i++)
+        finished.wait();
+    return nowMs() - start;
+}
+
+// A handler pushing more items than the ring can hold. The worker running it
+// can't wait for the ring to drain, since it's the one that drains it.
+void fanOut(size_t capacity, int numThreads, int numItems) {
+    LockFreeWorkQueue q(capacity);
+    std::atomic<int> done(0);
+    cz::Semaphore finished;
+    // Declared last, so the workers are stopped before anything they use is
+    // destroyed
+    Workers<LockFreeWorkQueue> workers(q, numThreads);
+
+    auto start = nowMs();
+    q.push([&] {
+        for (int i = 0; i < numItems; i++) {
+            q.push([&] {
+                if (++done == numItems)
+                    finished.notify();
+            });
+        }
+    });
+    finished.wait();
+    printf("Fan-out of %6d items, capacity %4d, %d threads: %7.2fms\n",
+           numItems, static_cast<int>(capacity), numThreads, nowMs() - start);
+}
+
+template <typename F>
+void compare(const char* name, int numThreads, F f) {
+    WorkQueue wq;
+    LockFreeWorkQueue lfq;
+    double a = f(wq, numThreads);
+    double b = f(lfq, numThreads);
+    printf("%-22s %2d threads: WorkQueue %7.2fms (%5.2f Mitems/s), "
+           "LockFreeWorkQueue %7.2fms (%5.2f Mitems/s)\n",
+           name, numThreads, a, kItems / a / 1000, b, kItems / b / 1000);
+}
+
+}  // namespace
+
+void queueSample() {
+    for (int numThreads : {1, 2, 4, 8}) {
+        compare("Producers/consumers", numThreads,
+                [](auto& q, int n) { return producersConsumers(q, n); });
+    }
+    for (int numThreads : {1, 2, 4, 8}) {
+        compare("Strands", numThreads,
+                [](auto& q, int n) { return strands(q, n); });
+    }
+    for (int numThreads : {1, 4})
+        fanOut(16, numThreads, 100);
+    fanOut(4096, 4, 100000);
+}
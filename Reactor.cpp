@@ -0,0 +1,103 @@
+#if defined(__linux__)
+#include "Reactor.h"
+#include <assert.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+Reactor::Reactor(WorkQueue& queue) : m_queue(queue) {
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    assert(m_epoll != -1);
+    m_wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    assert(m_wakeup != -1);
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeup, &ev);
+
+    m_queue.setPoller(this);
+}
+
+Reactor::~Reactor() {
+    m_queue.setPoller(nullptr);
+    close(m_wakeup);
+    close(m_epoll);
+}
+
+Reactor::Id Reactor::add(int fd, uint32_t events,
+                         std::function<void(std::function<void()>)> dispatch,
+                         std::function<void(uint32_t)> handler) {
+    auto w = std::make_shared<Watch>();
+    w->fd = fd;
+    w->events = events;
+    w->dispatch = std::move(dispatch);
+    w->handler = std::move(handler);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    w->id = m_nextId++;
+    epoll_event ev = {};
+    ev.events = events | EPOLLONESHOT;
+    ev.data.u64 = w->id;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+        return 0;
+    m_watches[w->id] = w;
+    return w->id;
+}
+
+bool Reactor::unwatch(Id id) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto it = m_watches.find(id);
+    if (it == m_watches.end())
+        return false;
+    it->second->active = false;
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, it->second->fd, nullptr);
+    m_watches.erase(it);
+    return true;
+}
+
+void Reactor::rearm(Watch& w) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (!w.active)
+        return;
+    epoll_event ev = {};
+    ev.events = w.events | EPOLLONESHOT;
+    ev.data.u64 = w.id;
+    epoll_ctl(m_epoll, EPOLL_CTL_MOD, w.fd, &ev);
+}
+
+void Reactor::poll(int timeoutMs, std::vector<std::function<void()>>& ready) {
+    epoll_event events[64];
+    int n = epoll_wait(m_epoll, events, 64, timeoutMs);
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.u64 == 0) {
+            uint64_t count;
+            while (read(m_wakeup, &count, sizeof(count)) > 0) {
+            }
+            continue;
+        }
+
+        auto it = m_watches.find(events[i].data.u64);
+        if (it == m_watches.end())
+            continue;
+        std::shared_ptr<Watch> w = it->second;
+        uint32_t readyEvents = events[i].events;
+        ready.push_back([this, w, readyEvents] {
+            w->dispatch([this, w, readyEvents] {
+                if (w->active)
+                    w->handler(readyEvents);
+                rearm(*w);
+            });
+        });
+    }
+}
+
+void Reactor::interrupt() {
+    uint64_t one = 1;
+    ssize_t res = write(m_wakeup, &one, sizeof(one));
+    (void)res;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+#if defined(__linux__)
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "WorkQueue.h"
+
+//
+// epoll based reactor, integrated with a WorkQueue's workers.
+//
+// One of the queue's idle workers waits in epoll_wait, and pushing work while
+// no other worker is idle wakes it up through an eventfd. When a file
+// descriptor is ready, its handler is dispatched straight into the owner (e.g:
+// a Strand) from the worker that received the event, so there are no I/O
+// threads, and no extra thread hop or queue round-trip per event.
+//
+// Watches are one-shot: the file descriptor is only re-armed once the handler
+// returns, so handlers for the same watch never execute concurrently.
+//
+// The Reactor must outlive any handlers already dispatched.
+//
+class Reactor : public WorkQueue::Poller {
+public:
+    using Id = uint64_t;
+
+    // Attaches to the queue, as its poller
+    explicit Reactor(WorkQueue& queue);
+    // Detaches from the queue
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // Watches "fd" for "events" (EPOLLIN, EPOLLOUT, ...). When ready,
+    // "handler(readyEvents)" is executed through "owner.dispatch".
+    // "owner" is typically a Strand, and must outlive the watch.
+    // Returns 0 on error.
+    template <typename Owner, typename F>
+    Id watch(int fd, uint32_t events, Owner& owner, F handler) {
+        return add(fd, events,
+                   [&owner](std::function<void()> h) {
+                       owner.dispatch(std::move(h));
+                   },
+                   std::function<void(uint32_t)>(std::move(handler)));
+    }
+
+    // Stops watching. A handler already dispatched can still execute.
+    bool unwatch(Id id);
+
+    //
+    // WorkQueue::Poller interface
+    //
+    void poll(int timeoutMs,
+              std::vector<std::function<void()>>& ready) override;
+    void interrupt() override;
+
+private:
+    struct Watch {
+        Id id;
+        int fd;
+        uint32_t events;
+        std::function<void(std::function<void()>)> dispatch;
+        std::function<void(uint32_t)> handler;
+        std::atomic<bool> active{true};
+    };
+
+    Id add(int fd, uint32_t events,
+           std::function<void(std::function<void()>)> dispatch,
+           std::function<void(uint32_t)> handler);
+    void rearm(Watch& w);
+
+    WorkQueue& m_queue;
+    int m_epoll;
+    // Used to interrupt epoll_wait. Registered with Id 0
+    int m_wakeup;
+    std::mutex m_mtx;
+    std::unordered_map<Id, std::shared_ptr<Watch>> m_watches;
+    Id m_nextId = 1;
+};
+
+#endif
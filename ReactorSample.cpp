@@ -0,0 +1,113 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include "Reactor.h"
+#include "Semaphore.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// One end of a socketpair, bouncing a counter back and forth with the other
+// end. All the socket handling is serialized by the connection's strand.
+struct Conn {
+    Conn(std::string name_, int fd_, WorkQueue& wq)
+        : name(std::move(name_)), fd(fd_), strand(wq) {}
+
+    void onReadable(uint32_t events) {
+        assert(strand.runningInThisThread());
+        if (events & (EPOLLHUP | EPOLLERR))
+            return;
+        int val;
+        while (read(fd, &val, sizeof(val)) == sizeof(val)) {
+            received++;
+            if (val < todo) {
+                val++;
+                ssize_t res = write(fd, &val, sizeof(val));
+                (void)res;
+            } else {
+                done->notify();
+            }
+        }
+    }
+
+    std::string name;
+    int fd;
+    int received = 0;
+    int todo = 0;
+    cz::Semaphore* done = nullptr;
+    Strand<WorkQueue> strand;
+};
+
+}  // namespace
+
+void reactorSample() {
+    WorkQueue workQueue;
+    Reactor reactor(workQueue);
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < 4; i++) {
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    }
+
+    const int numPairs = 8;
+    const int todo = 10000;
+    cz::Semaphore done;
+    std::vector<std::unique_ptr<Conn>> conns;
+    for (int i = 0; i < numPairs; i++) {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+        for (int fd : fds) {
+            conns.push_back(std::make_unique<Conn>(
+                "Conn " + std::to_string(conns.size()), fd, workQueue));
+            Conn* c = conns.back().get();
+            c->todo = todo;
+            c->done = &done;
+            reactor.watch(fd, EPOLLIN, c->strand,
+                          [c](uint32_t events) { c->onReadable(events); });
+        }
+    }
+
+    // Kick off the ping-pong on all pairs
+    auto start = nowMs();
+    for (int i = 0; i < numPairs; i++) {
+        int val = 1;
+        ssize_t res = write(conns[i * 2]->fd, &val, sizeof(val));
+        (void)res;
+    }
+    for (int i = 0; i < numPairs; i++)
+        done.wait();
+    auto elapsed = nowMs() - start;
+
+    int received = 0;
+    for (auto&& c : conns)
+        received += c->received;
+    printf("%d round trips over %d socket pairs in %5.2fms (%5.2fus per "
+           "message)\n",
+           received / 2, numPairs, elapsed, elapsed * 1000 / received);
+    assert(received == numPairs * todo);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads) {
+        t.join();
+    }
+    for (auto&& c : conns)
+        close(c->fd);
+}
+
+#else
+
+void reactorSample() {
+    printf("Reactor is only available on Linux\n");
+}
+
+#endif
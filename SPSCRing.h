@@ -0,0 +1,82 @@
+#pragma once
+#include "CacheLine.h"
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+//
+// Bounded single producer / single consumer lock-free FIFO queue.
+//
+// The producer and consumer each keep their index in their own cache line,
+// along with a cached copy of the other side's index, so they only read each
+// other's cache line when the cached copy says the queue is full (or empty).
+// The cache lines are separated with padding rather than alignment, since the
+// rings are allocated on the heap, which doesn't respect over-alignment before
+// C++17.
+//
+template <typename T>
+class SPSCRing {
+public:
+    // "capacity" is rounded up to a power of two
+    explicit SPSCRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        m_items.resize(size);
+        m_mask = size - 1;
+    }
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    // Producer only. Returns false if the queue is full
+    bool tryPush(T& v) {
+        size_t tail = m_prod.tail.load(std::memory_order_relaxed);
+        if (tail - m_prod.cachedHead > m_mask) {
+            m_prod.cachedHead = m_cons.head.load(std::memory_order_acquire);
+            if (tail - m_prod.cachedHead > m_mask)
+                return false;
+        }
+        m_items[tail & m_mask] = std::move(v);
+        m_prod.tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the queue is empty
+    bool tryPop(T& v) {
+        size_t head = m_cons.head.load(std::memory_order_relaxed);
+        if (head == m_cons.cachedTail) {
+            m_cons.cachedTail = m_prod.tail.load(std::memory_order_acquire);
+            if (head == m_cons.cachedTail)
+                return false;
+        }
+        v = std::move(m_items[head & m_mask]);
+        m_cons.head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Can be called from any thread, but the result is only a snapshot
+    bool empty() const {
+        return m_cons.head.load(std::memory_order_acquire) ==
+               m_prod.tail.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Producer {
+        std::atomic<size_t> tail{0};
+        size_t cachedHead = 0;
+    };
+    struct Consumer {
+        std::atomic<size_t> head{0};
+        size_t cachedTail = 0;
+    };
+
+    char m_pad0[kCacheLineSize];
+    Producer m_prod;
+    char m_pad1[kCacheLineSize];
+    Consumer m_cons;
+    char m_pad2[kCacheLineSize];
+    std::vector<T> m_items;
+    size_t m_mask;
+};
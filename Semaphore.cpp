@@ -8,70 +8,157 @@
 *********************************************************************/
 
 #include "Semaphore.h"
+#include "Futex.h"
+#include <assert.h>
+#include <vector>
 
 namespace cz
 {
 
+namespace
+{
+// Layout of the state word
+const uint32_t kSleepersFlag = 1u << 31;
+const uint32_t kAsyncFlag = 1u << 30;
+const uint32_t kCountMask = kAsyncFlag - 1;
+}
+
 void cz::Semaphore::notify()
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_count++;
-	m_cv.notify_one();
+	notify(1);
 }
 
-void cz::Semaphore::wait()
+void cz::Semaphore::notify(unsigned int n)
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_cv.wait(lock, [this]() {return m_count > 0; });
-	while (m_count == 0) {
-		m_cv.wait(lock);
+	std::vector<std::function<void()>> ready;
+	uint32_t state = m_state.load();
+	while (n)
+	{
+		// Asynchronous waiters register with the count at zero, and are
+		// handed it directly
+		if (state & kAsyncFlag)
+		{
+			takeAsyncWaiters(n, ready);
+			state = m_state.load();
+			continue;
+		}
+		assert((state & kCountMask) + n <= kCountMask);
+		if (m_state.compare_exchange_weak(state, state + n))
+			break;
 	}
-	m_count--;
+	// Whoever takes the count can destroy the semaphore, so only the word's
+	// address is used from here on
+	if (n && (state & kSleepersFlag))
+		futexWake(m_state, n);
+	// Posted outside the lock
+	for (auto&& post : ready)
+		post();
 }
 
-bool cz::Semaphore::trywait()
+void cz::Semaphore::wait()
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	if (m_count)
+	if (trywait())
+		return;
+	addSleeper();
+	uint32_t state;
+	while (!trywait())
 	{
-		m_count--;
-		return true;
+		if (prepareSleep(state))
+			futexWait(m_state, state);
 	}
-	else
+	removeSleeper();
+}
+
+bool cz::Semaphore::trywait()
+{
+	uint32_t state = m_state.load();
+	while (state & kCountMask)
 	{
-		return false;
+		if (m_state.compare_exchange_weak(state, state - 1,
+		                                  std::memory_order_acquire))
+			return true;
 	}
+	return false;
 }
 
-void ZeroSemaphore::increment()
+void cz::Semaphore::addSleeper()
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_count++;
+	m_sleepers.fetch_add(1);
 }
 
-void ZeroSemaphore::decrement()
+void cz::Semaphore::removeSleeper()
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_count--;
-	m_cv.notify_all();
+	if (m_sleepers.fetch_sub(1) != 1)
+		return;
+	// The last sleeper to leave clears the flag. If another one arrived
+	// meanwhile, the flag is set again, and a "notify" that missed it in
+	// between is passed on
+	m_state.fetch_and(~kSleepersFlag);
+	if (m_sleepers.load() == 0)
+		return;
+	if (m_state.fetch_or(kSleepersFlag) & kCountMask)
+		futexWakeOne(m_state);
 }
 
-void ZeroSemaphore::wait()
+bool cz::Semaphore::prepareSleep(uint32_t& state)
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	m_cv.wait(lock, [this]()
+	state = m_state.load();
+	while (!(state & kCountMask))
 	{
-		return m_count == 0;
-	});
+		if (state & kSleepersFlag)
+			return true;
+		if (m_state.compare_exchange_weak(state, state | kSleepersFlag))
+		{
+			state |= kSleepersFlag;
+			return true;
+		}
+	}
+	return false;
+}
+
+void cz::Semaphore::sleepFor(std::chrono::nanoseconds timeout)
+{
+	uint32_t state;
+	if (prepareSleep(state))
+		futexWaitFor(m_state, state, timeout);
 }
 
-bool ZeroSemaphore::trywait()
+void cz::Semaphore::addAsyncWaiter(std::function<void()> post)
 {
-	std::unique_lock<std::mutex> lock(m_mtx);
-	if (m_count == 0)
-		return true;
-	else
-		return false;
+	{
+		std::lock_guard<std::mutex> lock(m_asyncMtx);
+		uint32_t state = m_state.load();
+		while (true)
+		{
+			if (state & kCountMask)
+			{
+				if (m_state.compare_exchange_weak(state, state - 1,
+				                                  std::memory_order_acquire))
+					break;
+			}
+			else if (m_state.compare_exchange_weak(state, state | kAsyncFlag))
+			{
+				// "notify" sees the flag, and takes the waiter under the lock
+				m_async.push_back(std::move(post));
+				return;
+			}
+		}
+	}
+	post();
+}
+
+void cz::Semaphore::takeAsyncWaiters(unsigned int& n,
+                                     std::vector<std::function<void()>>& ready)
+{
+	std::lock_guard<std::mutex> lock(m_asyncMtx);
+	while (n && m_async.size())
+	{
+		ready.push_back(std::move(m_async.front()));
+		m_async.pop_front();
+		n--;
+	}
+	if (m_async.empty())
+		m_state.fetch_and(~kAsyncFlag);
 }
 
 } // namespace cz
@@ -9,37 +9,134 @@
 
 #pragma once
 
+#include "Coroutine.h"
+#include "Priority.h"
+#include "WaitGroup.h"
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 
 namespace cz {
 
+//!
+// Counting semaphore. The count is a single atomic, so "notify", "trywait" and
+// "wait" with a positive count don't take any lock. Only waiting for the count
+// to become positive sleeps, on a futex (see Futex.h).
+// Whether there are sleeping or asynchronous waiters is kept in the same word
+// as the count, so incrementing it is the last access "notify" makes to the
+// semaphore, which can be destroyed as soon as a waiter returns.
 class Semaphore {
 public:
-    Semaphore(unsigned int count = 0) : m_count(count) {}
+    Semaphore(unsigned int count = 0) : m_state(count) {}
     void notify();
+    // Adds "n" to the count, waking up to "n" waiters
+    void notify(unsigned int n);
     void wait();
     bool trywait();
 
+    // Same as "wait", but gives up after the timeout. Returns true if the
+    // count was decremented
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+    template <typename Clock, typename Duration>
+    bool wait_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (trywait())
+            return true;
+        addSleeper();
+        bool acquired = false;
+        while (!(acquired = trywait())) {
+            auto left = deadline - Clock::now();
+            if (left <= left.zero())
+                break;
+            sleepFor(std::chrono::duration_cast<std::chrono::nanoseconds>(left));
+        }
+        removeSleeper();
+        return acquired;
+    }
+
+    // Non-blocking "wait", for handlers executing in a Processor. Once the
+    // count is decremented, "continuation" is posted to "ex" (a Strand, or a
+    // Processor), with no thread blocked meanwhile.
+    template <typename Executor, typename F>
+    void async_wait(Executor& ex, F continuation) {
+        addAsyncWaiter([&ex, continuation]() mutable {
+            detail::postTo(ex, std::move(continuation));
+        });
+    }
+
+#if CZ_HAS_COROUTINES
+    // "co_await sem.async_wait(ex)"
+    template <typename Executor>
+    AsyncWaitAwaiter<Semaphore, Executor> async_wait(Executor& ex) {
+        return AsyncWaitAwaiter<Semaphore, Executor>(*this, ex);
+    }
+#endif
+
 private:
-    std::mutex m_mtx;
-    std::condition_variable m_cv;
-    unsigned int m_count;
+    void addAsyncWaiter(std::function<void()> post);
+    // Hands up to "n" units of the count to asynchronous waiters, instead of
+    // incrementing it, and decrements "n" accordingly
+    void takeAsyncWaiters(unsigned int& n,
+                          std::vector<std::function<void()>>& ready);
+
+    // Sleepers register before checking the count, and unregister once done
+    void addSleeper();
+    void removeSleeper();
+    // Flags the count as having sleepers. Returns false if it's positive, and
+    // so there is no need to sleep
+    bool prepareSleep(uint32_t& state);
+    // Sleeps while the count is zero, for at most "timeout"
+    void sleepFor(std::chrono::nanoseconds timeout);
+
+    // The count, plus flags for sleeping and asynchronous waiters
+    std::atomic<uint32_t> m_state;
+    // Threads sleeping (or about to). Only they access it, so the last one to
+    // leave can clear the flag, letting "notify" skip the system call
+    std::atomic<uint32_t> m_sleepers{0};
+    // Asynchronous waiters, oldest first
+    std::mutex m_asyncMtx;
+    std::deque<std::function<void()>> m_async;
 };
 
 //!
-// Blocks until the counter reaches zero
+// Blocks until the counter reaches zero.
+// Kept for existing code. It's a WaitGroup (see WaitGroup.h), so waiters
+// only wake up once the counter reaches zero.
 class ZeroSemaphore {
 public:
     ZeroSemaphore() {}
-    void increment();
-    void decrement();
-    void wait();
-    bool trywait();
+    void increment() {
+        m_wg.add(1);
+    }
+    void decrement() {
+        m_wg.done();
+    }
+    void wait() {
+        m_wg.wait();
+    }
+    bool trywait() {
+        return m_wg.trywait();
+    }
+    template <typename Executor, typename F>
+    void async_wait(Executor& ex, F continuation) {
+        m_wg.async_wait(ex, std::move(continuation));
+    }
+#if CZ_HAS_COROUTINES
+    template <typename Executor>
+    AsyncWaitAwaiter<WaitGroup, Executor> async_wait(Executor& ex) {
+        return m_wg.async_wait(ex);
+    }
+#endif
 
 private:
-    std::mutex m_mtx;
-    std::condition_variable m_cv;
-    int m_count = 0;
+    WaitGroup m_wg;
 };
 }
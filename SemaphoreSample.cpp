@@ -0,0 +1,222 @@
+#include "Semaphore.h"
+#include "WaitGroup.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kRoundTrips = 100000;
+const int kUncontendedOps = 5000000;
+const int kTimeoutMs = 5;
+// Fan-in: threads finishing tasks, while others wait for all of them
+const int kFanInTasks = 200000;
+const int kFanInThreads = 4;
+const int kFanInWaiters = 8;
+const int kBarrierPhases = 10000;
+const int kLifetimeRounds = 2000;
+
+// The previous cz::Semaphore, always going through a mutex and a condition
+// variable, for comparison
+class CondVarSemaphore {
+public:
+    void notify() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_count++;
+        m_cv.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cv.wait(lock, [this]() { return m_count > 0; });
+        m_count--;
+    }
+
+private:
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    unsigned int m_count = 0;
+};
+
+// Two threads passing a token back and forth. Returns nanoseconds per round
+// trip
+template <typename Sem>
+double pingPong() {
+    Sem ping, pong;
+    std::thread other([&] {
+        for (int i = 0; i < kRoundTrips; i++) {
+            ping.wait();
+            pong.notify();
+        }
+    });
+
+    auto start = nowMs();
+    for (int i = 0; i < kRoundTrips; i++) {
+        ping.notify();
+        pong.wait();
+    }
+    auto elapsed = nowMs() - start;
+    other.join();
+    return elapsed * 1000000 / kRoundTrips;
+}
+
+// notify/wait pairs with nobody waiting. Returns nanoseconds per pair
+template <typename Sem>
+double uncontended() {
+    Sem sem;
+    auto start = nowMs();
+    for (int i = 0; i < kUncontendedOps; i++) {
+        sem.notify();
+        sem.wait();
+    }
+    return (nowMs() - start) * 1000000 / kUncontendedOps;
+}
+
+// The previous cz::ZeroSemaphore, waking up the waiters on every decrement
+class CondVarZeroSemaphore {
+public:
+    void add(int n) {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_count += n;
+    }
+
+    void done() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_count--;
+        m_cv.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cv.wait(lock, [this]() { return m_count == 0; });
+    }
+
+private:
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    int m_count = 0;
+};
+
+// Milliseconds until all the tasks are done, and all the waiters noticed
+template <typename Group>
+double fanIn() {
+    Group group;
+    group.add(kFanInTasks);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kFanInWaiters; i++)
+        threads.push_back(std::thread([&group] { group.wait(); }));
+
+    auto start = nowMs();
+    for (int i = 0; i < kFanInThreads; i++) {
+        threads.push_back(std::thread([&group] {
+            for (int n = 0; n < kFanInTasks / kFanInThreads; n++)
+                group.done();
+        }));
+    }
+    for (auto&& t : threads)
+        t.join();
+    return nowMs() - start;
+}
+
+template <typename Sem>
+void run(const char* name) {
+    printf("%-16s: ping-pong %8.1fns per round trip, uncontended %6.1fns per "
+           "notify/wait\n",
+           name, pingPong<Sem>(), uncontended<Sem>());
+}
+
+// Threads going through a barrier in lockstep, checking nobody gets ahead of
+// the others
+void runBarrier() {
+    cz::Barrier barrier(kFanInThreads);
+    std::atomic<int> arrivals(0);
+    std::atomic<bool> ahead(false);
+    std::vector<std::thread> threads;
+    auto start = nowMs();
+    for (int i = 0; i < kFanInThreads; i++) {
+        threads.push_back(std::thread([&] {
+            for (int phase = 0; phase < kBarrierPhases; phase++) {
+                arrivals++;
+                barrier.arriveAndWait();
+                if (arrivals.load() < (phase + 1) * kFanInThreads)
+                    ahead = true;
+                barrier.arriveAndWait();
+            }
+        }));
+    }
+    for (auto&& t : threads)
+        t.join();
+    printf("Barrier: %d threads, %d phases, %.2fus per phase%s\n",
+           kFanInThreads, kBarrierPhases * 2,
+           (nowMs() - start) * 1000 / (kBarrierPhases * 2),
+           ahead ? ", BROKEN" : "");
+}
+
+// Destroys the group and the semaphore as soon as they are signaled, while
+// "done" and "notify" might not have returned yet. Every other round waits by
+// polling, which sees the signal the earliest.
+void runLifetime() {
+    for (int i = 0; i < kLifetimeRounds; i++) {
+        auto group = std::make_unique<cz::WaitGroup>(1);
+        auto sem = std::make_unique<cz::Semaphore>();
+        cz::WaitGroup* g = group.get();
+        cz::Semaphore* s = sem.get();
+        std::thread t([g, s] {
+            g->done();
+            s->notify();
+        });
+        bool poll = i % 2 == 0;
+        if (poll) {
+            while (!group->trywait())
+                std::this_thread::yield();
+        } else {
+            group->wait();
+        }
+        group.reset();
+        if (poll) {
+            while (!sem->trywait())
+                std::this_thread::yield();
+        } else {
+            sem->wait();
+        }
+        sem.reset();
+        t.join();
+    }
+    printf("Destroyed as soon as signaled: %d rounds\n", kLifetimeRounds);
+}
+
+}  // namespace
+
+void semaphoreSample() {
+    run<CondVarSemaphore>("mutex+condvar");
+    run<cz::Semaphore>("cz::Semaphore");
+
+    printf("Fan-in of %d tasks from %d threads, with %d waiters\n",
+           kFanInTasks, kFanInThreads, kFanInWaiters);
+    printf("%-16s: %7.2fms\n", "mutex+condvar", fanIn<CondVarZeroSemaphore>());
+    printf("%-16s: %7.2fms\n", "cz::WaitGroup", fanIn<cz::WaitGroup>());
+
+    runBarrier();
+    runLifetime();
+
+    // Timeouts, and waking several waiters at once
+    cz::Semaphore sem;
+    auto start = nowMs();
+    bool acquired = sem.wait_for(std::chrono::milliseconds(kTimeoutMs));
+    printf("wait_for(%dms) on a zero count: %s after %.2fms\n", kTimeoutMs,
+           acquired ? "acquired" : "timed out", nowMs() - start);
+
+    std::thread waiters[4];
+    for (auto&& t : waiters)
+        t = std::thread([&sem] { sem.wait(); });
+    sem.notify(4);
+    for (auto&& t : waiters)
+        t.join();
+    printf("notify(4) released 4 waiters, count is back to %s\n",
+           sem.trywait() ? "non zero" : "zero");
+}
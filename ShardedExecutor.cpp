@@ -0,0 +1,214 @@
+#include "ShardedExecutor.h"
+#include "PerWorker.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+// Items a shard executes from each of its queues, before checking the others
+const size_t gBatchSize = 64;
+}  // namespace
+
+ShardedExecutor::ShardedExecutor() : ShardedExecutor(Options()) {}
+
+ShardedExecutor::ShardedExecutor(Options opts)
+    : m_mailboxCapacity(opts.mailboxCapacity) {
+    if (opts.topology.nodes.empty())
+        opts.topology = Topology::singleNode();
+    std::vector<int> cpus;
+    for (auto&& node : opts.topology.nodes)
+        cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+    unsigned count = opts.numShards ? opts.numShards
+                                    : static_cast<unsigned>(cpus.size());
+    count = std::max(count, 1u);
+
+    for (unsigned i = 0; i < count; i++)
+        m_shards.push_back(std::unique_ptr<Shard>(new Shard(*this, i, count)));
+
+    for (unsigned i = 0; i < count; i++) {
+        std::vector<int> pinTo;
+        if (opts.pinning && cpus.size())
+            pinTo.push_back(cpus[i % cpus.size()]);
+        Shard* s = m_shards[i].get();
+        m_threads.push_back(
+            std::thread([this, s, pinTo] { shardMain(*s, std::move(pinTo)); }));
+    }
+}
+
+ShardedExecutor::~ShardedExecutor() {
+    stop();
+}
+
+void ShardedExecutor::pushToShard(Shard& shard, std::function<void()> w) {
+    // Pushes are counted before the item is queued (see "stop"). Each count
+    // has a single writer, or is protected by the shard's lock, so posting
+    // from another shard takes no synchronization beyond the mailbox.
+    Shard* from = currentShard();
+    if (from == &shard) {
+        // The shard is running, so no need to wake it up
+        shard.m_localPushed.store(
+            shard.m_localPushed.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+        shard.m_local.push_back(std::move(w));
+        return;
+    }
+
+    bool queued = false;
+    if (from) {
+        Shard::Mailbox& mailbox = shard.inboxFrom(*from);
+        uint64_t pushed = mailbox.pushed.load(std::memory_order_relaxed);
+        mailbox.pushed.store(pushed + 1, std::memory_order_relaxed);
+        // The ring's release store also publishes the count
+        queued = mailbox.ring.tryPush(w);
+        // Briefly overcounting only makes "stop" check again
+        if (!queued)
+            mailbox.pushed.store(pushed, std::memory_order_relaxed);
+    }
+    if (!queued) {
+        std::lock_guard<std::mutex> lock(shard.m_mtx);
+        shard.m_externalPushed++;
+        shard.m_external.push_back(std::move(w));
+        shard.m_hasExternal = true;
+    }
+
+    // Pairs with the fence in "shardMain": either the shard sees the item
+    // when checking its queues again, or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard.m_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(shard.m_mtx);
+        shard.m_wakeup = true;
+        shard.m_cond.notify_one();
+    }
+}
+
+ShardedExecutor::Shard::~Shard() {
+    for (auto&& mailbox : m_inbox)
+        delete mailbox.load();
+}
+
+bool ShardedExecutor::Shard::hasWork() const {
+    if (m_local.size() || m_hasExternal)
+        return true;
+    for (auto&& slot : m_inbox) {
+        Mailbox* mailbox = slot.load(std::memory_order_acquire);
+        if (mailbox && !mailbox->ring.empty())
+            return true;
+    }
+    return false;
+}
+
+ShardedExecutor::Shard::Mailbox& ShardedExecutor::Shard::inboxFrom(
+    const Shard& from) {
+    // Only "from" stores to its slot
+    std::atomic<Mailbox*>& slot = m_inbox[from.m_index];
+    Mailbox* mailbox = slot.load(std::memory_order_relaxed);
+    if (!mailbox) {
+        mailbox = new Mailbox(m_owner.m_mailboxCapacity);
+        slot.store(mailbox, std::memory_order_release);
+    }
+    return *mailbox;
+}
+
+uint64_t ShardedExecutor::Shard::pushed() {
+    uint64_t count = m_localPushed;
+    for (auto&& slot : m_inbox) {
+        Mailbox* mailbox = slot.load(std::memory_order_acquire);
+        if (mailbox)
+            count += mailbox->pushed;
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return count + m_externalPushed;
+}
+
+size_t ShardedExecutor::runQueued(Shard& shard) {
+    size_t count = 0;
+    std::function<void()> w;
+
+    for (size_t i = shard.m_local.size(); i && count < gBatchSize; i--) {
+        w = std::move(shard.m_local.front());
+        shard.m_local.pop_front();
+        w();
+        count++;
+    }
+
+    for (auto&& slot : shard.m_inbox) {
+        Shard::Mailbox* mailbox = slot.load(std::memory_order_acquire);
+        if (!mailbox)
+            continue;
+        for (size_t i = 0; i < gBatchSize && mailbox->ring.tryPop(w); i++) {
+            w();
+            count++;
+        }
+    }
+
+    if (shard.m_hasExternal) {
+        std::deque<std::function<void()>> external;
+        {
+            std::lock_guard<std::mutex> lock(shard.m_mtx);
+            external.swap(shard.m_external);
+            shard.m_hasExternal = false;
+        }
+        for (auto&& item : external)
+            item();
+        count += external.size();
+    }
+
+    return count;
+}
+
+void ShardedExecutor::shardMain(Shard& shard, std::vector<int> cpus) {
+    if (cpus.size())
+        pinCurrentThread(cpus);
+
+    Callstack<ShardedExecutor, Shard>::Context ctx(this, shard);
+    WorkerId::Scope workerId(shard.m_index);
+    while (true) {
+        size_t count = runQueued(shard);
+        if (count) {
+            shard.m_executed.store(
+                shard.m_executed.load(std::memory_order_relaxed) + count);
+            continue;
+        }
+
+        if (m_stopping)
+            return;
+
+        shard.m_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!shard.hasWork()) {
+            std::unique_lock<std::mutex> lock(shard.m_mtx);
+            shard.m_cond.wait(lock, [&] { return shard.m_wakeup; });
+            shard.m_wakeup = false;
+        }
+        shard.m_sleeping = false;
+    }
+}
+
+void ShardedExecutor::stop() {
+    // Items are counted as pushed before they are queued, and as executed
+    // after they execute, so if all the executed counts (read first) match
+    // the pushed counts (read after), nothing was queued or executing in
+    // between, and nothing else can be pushed.
+    while (!m_stopping) {
+        uint64_t executed = 0;
+        uint64_t pushed = 0;
+        for (auto&& shard : m_shards)
+            executed += shard->m_executed;
+        for (auto&& shard : m_shards)
+            pushed += shard->pushed();
+        if (executed == pushed)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    m_stopping = true;
+    for (auto&& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->m_mtx);
+        shard->m_wakeup = true;
+        shard->m_cond.notify_all();
+    }
+
+    for (auto&& t : m_threads) {
+        if (t.joinable())
+            t.join();
+    }
+}
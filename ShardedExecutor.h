@@ -0,0 +1,287 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CacheLine.h"
+#include "Callstack.h"
+#include "Continuation.h"
+#include "SPSCRing.h"
+#include "Strand.h"
+#include "Topology.h"
+
+//
+// Thread-per-core executor, following a shared-nothing model.
+//
+// Each shard has a single worker thread (pinned to its own CPU), and owns the
+// strands homed to it. Work a shard pushes to itself goes to a plain local
+// queue. Work pushed from another shard goes through a single producer /
+// single consumer ring dedicated to that pair of shards, so shards never
+// contend on a shared queue. The rings are only allocated once a shard
+// actually pushes to the other. Work pushed from outside the shards (or when a
+// ring is full) goes to a mutex protected queue.
+//
+// A Strand can be homed to a shard by using the shard as its Processor:
+//
+//	Strand<ShardedExecutor::Shard> strand(executor.shardFor(key));
+//
+// Since the shard has a single thread, that Strand specialization (see below)
+// has no queue or lock of its own, and pushes handlers straight to the shard.
+//
+class ShardedExecutor {
+public:
+    struct Options {
+        Topology topology = Topology::discover();
+        // If 0, it creates one shard per CPU
+        unsigned numShards = 0;
+        // Pin each shard to a CPU
+        bool pinning = true;
+        // Size of the rings between each pair of shards
+        size_t mailboxCapacity = 1024;
+    };
+
+    // It implements the Processor interface, so work pushed here is executed
+    // by the shard's thread.
+    class Shard {
+    public:
+        ~Shard();
+        Shard(const Shard&) = delete;
+        Shard& operator=(const Shard&) = delete;
+
+        // If the work item returns a Continuation, it's pushed to this shard
+        // again once the item returns
+        template <typename F>
+        void push(F w) {
+            m_owner.pushToShard(*this, detail::repushing(*this, std::move(w)));
+        }
+
+        bool canDispatch() {
+            return m_owner.currentShard() == this;
+        }
+
+        // Also the worker index of the shard's thread (see WorkerId in
+        // PerWorker.h)
+        unsigned index() const {
+            return m_index;
+        }
+
+    private:
+        friend class ShardedExecutor;
+
+        // Ring receiving the work pushed by another shard
+        struct Mailbox {
+            explicit Mailbox(size_t capacity) : ring(capacity) {}
+            SPSCRing<std::function<void()>> ring;
+            // Items pushed to the ring. Only written by the producing shard,
+            // so it needs no read-modify-write.
+            alignas(kCacheLineSize) std::atomic<uint64_t> pushed{0};
+        };
+
+        Shard(ShardedExecutor& owner, unsigned index, unsigned numShards)
+            : m_owner(owner), m_index(index), m_inbox(numShards) {}
+
+        // Tells if there is anything to execute. Only accurate if called from
+        // the shard's thread.
+        bool hasWork() const;
+        // Mailbox receiving the work pushed by "from", allocating it if
+        // needed. Only called from the thread of "from".
+        Mailbox& inboxFrom(const Shard& from);
+        // Number of items ever pushed to this shard, through any queue
+        uint64_t pushed();
+
+        ShardedExecutor& m_owner;
+        unsigned m_index;
+        // m_inbox[i] receives the work pushed by shard i, or is nullptr if
+        // shard i never pushed to this shard
+        std::vector<std::atomic<Mailbox*>> m_inbox;
+
+        // Only written by the shard's thread, so it's kept apart from what
+        // other threads write when pushing.
+        // Work pushed by the shard itself
+        alignas(kCacheLineSize) std::deque<std::function<void()>> m_local;
+        // Number of items pushed to m_local, and executed by the shard, so
+        // "stop" can tell when all shards are done (along with the pushed
+        // counts of the mailboxes, and m_externalPushed)
+        std::atomic<uint64_t> m_localPushed{0};
+        std::atomic<uint64_t> m_executed{0};
+
+        alignas(kCacheLineSize) std::mutex m_mtx;
+        // Work pushed from outside, or when a mailbox is full, and how many
+        // items were ever pushed there. Protected by m_mtx
+        std::deque<std::function<void()>> m_external;
+        uint64_t m_externalPushed = 0;
+        std::atomic<bool> m_hasExternal{false};
+        // The thread is (about to be) sleeping, and if it was told to resume
+        std::atomic<bool> m_sleeping{false};
+        bool m_wakeup = false;
+        std::condition_variable m_cond;
+    };
+
+    // Creates and starts the shards, with the default options
+    ShardedExecutor();
+    explicit ShardedExecutor(Options opts);
+    ~ShardedExecutor();
+
+    ShardedExecutor(const ShardedExecutor&) = delete;
+    ShardedExecutor& operator=(const ShardedExecutor&) = delete;
+
+    // Add a new work item to the current shard if called from a shard, or to
+    // the shards in a round-robin fashion otherwise.
+    // If it returns a Continuation, it's pushed to the same shard again.
+    template <typename F>
+    void push(F w) {
+        Shard* shard = currentShard();
+        if (!shard)
+            shard = m_shards[m_next++ % m_shards.size()].get();
+        shard->push(std::move(w));
+    }
+
+    // Tells if a shard is executing in the current thread
+    bool canDispatch() {
+        return currentShard() != nullptr;
+    }
+
+    // Shard executing in the current thread, or nullptr
+    Shard* currentShard() {
+        return Callstack<ShardedExecutor, Shard>::contains(this);
+    }
+
+    size_t numShards() const {
+        return m_shards.size();
+    }
+
+    Shard& shard(size_t index) {
+        return *m_shards[index];
+    }
+
+    // Shard owning the specified key
+    template <typename K>
+    Shard& shardFor(const K& key) {
+        return *m_shards[std::hash<K>()(key) % m_shards.size()];
+    }
+
+    // Waits for all shards to be idle with nothing queued, and stops them.
+    // Work must not be pushed from outside the shards once this is called.
+    // Must not be called from a shard.
+    void stop();
+
+private:
+    void pushToShard(Shard& shard, std::function<void()> w);
+    void shardMain(Shard& shard, std::vector<int> cpus);
+    // Executes what is queued in the shard. Returns the number of items
+    size_t runQueued(Shard& shard);
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    size_t m_mailboxCapacity;
+    std::vector<std::thread> m_threads;
+    std::atomic<unsigned> m_next{0};
+    std::atomic<bool> m_stopping{false};
+};
+
+//
+// Strand homed to a shard.
+// Since the shard only has a single thread, its work items never execute
+// concurrently, so the strand needs no queue or lock of its own. Handlers are
+// pushed straight to the shard, through the mailbox from the posting shard.
+// It has the same interface as the generic Strand, so code can switch between
+// the two.
+//
+template <>
+class Strand<ShardedExecutor::Shard> {
+public:
+    Strand(ShardedExecutor::Shard& shard) : m_shard(shard) {}
+
+    // There is no lock, so any lock arguments are ignored
+    template <typename... LockArgs>
+    Strand(ShardedExecutor::Shard& shard, LockArgs&&...) : m_shard(shard) {}
+
+    Strand(const Strand&) = delete;
+    Strand& operator=(const Strand&) = delete;
+
+    // Executes the handler immediately if called from the strand's shard, or
+    // posts it otherwise
+    template <typename F>
+    void dispatch(F handler, Priority prio = Priority::Normal) {
+        if (m_shard.canDispatch()) {
+            Callstack<Strand>::Context ctx(this);
+            run(handler, detail::returnsContinuation<F>());
+        } else {
+            post(std::move(handler), prio);
+        }
+    }
+
+    // Post an handler for execution and returns immediately.
+    // Priorities are ignored, since shards execute everything in order.
+    // Handlers posted from another shard can still overtake each other if the
+    // mailbox between the shards fills up, since the rest go through the
+    // shard's external queue meanwhile.
+    // If the handler returns a Continuation, it's posted once the handler
+    // returns.
+    template <typename F>
+    void post(F handler, Priority prio = Priority::Normal) {
+        (void)prio;
+        m_shard.push([this, handler]() mutable {
+            Callstack<Strand>::Context ctx(this);
+            run(handler, detail::returnsContinuation<F>());
+        });
+    }
+
+    // Same as "post", but the handler is skipped if it doesn't start by the
+    // deadline
+    template <typename F>
+    void post(F handler, Deadline deadline, Priority prio = Priority::Normal) {
+        auto next = detail::toContinuation(std::move(handler));
+        post(
+            [this, next, deadline]() mutable -> Continuation {
+                if (!deadline.expired(Deadline::Clock::now()))
+                    return next();
+                m_expired.fetch_add(1, std::memory_order_relaxed);
+                if (deadline.onExpired)
+                    deadline.onExpired();
+                return {};
+            },
+            prio);
+    }
+
+    // Number of handlers skipped due to their deadline
+    uint64_t expired() const {
+        return m_expired.load(std::memory_order_relaxed);
+    }
+
+    // Same as "post", since posted handlers already go behind anything queued
+    // in the shard
+    template <typename F>
+    void defer(F handler, Priority prio = Priority::Normal) {
+        post(std::move(handler), prio);
+    }
+
+    // Checks if we are currently running the strand in this thread
+    bool runningInThisThread() {
+        return Callstack<Strand>::contains(this) != nullptr;
+    }
+
+    ShardedExecutor::Shard& shard() {
+        return m_shard;
+    }
+
+private:
+    template <typename F>
+    void run(F& handler, std::true_type) {
+        Continuation next = handler();
+        if (next)
+            post(std::move(next));
+    }
+
+    template <typename F>
+    void run(F& handler, std::false_type) {
+        handler();
+    }
+
+    ShardedExecutor::Shard& m_shard;
+    std::atomic<uint64_t> m_expired{0};
+};
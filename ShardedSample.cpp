@@ -0,0 +1,98 @@
+#include "ShardedExecutor.h"
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 4;
+const int kNumObjs = 64;
+// Messages travelling between the objects at the same time
+const int kNumChains = 16;
+const int kHops = 50000;
+
+// Object with a strand, handing messages to other objects
+template <typename Processor>
+struct Obj {
+    Obj(int id, Processor& proc) : id(id), strand(proc) {}
+    int id;
+    int received = 0;
+    Strand<Processor> strand;
+};
+
+// Runs message chains hopping between objects, and returns the time taken.
+// "procFor(id)" gives the processor for the object's strand, and "stop" stops
+// the processors, before the strands are destroyed.
+template <typename Processor, typename F, typename S>
+double hops(const F& procFor, const S& stop) {
+    std::vector<std::unique_ptr<Obj<Processor>>> objs;
+    for (int i = 0; i < kNumObjs; i++)
+        objs.push_back(std::make_unique<Obj<Processor>>(i, procFor(i)));
+
+    cz::Semaphore done;
+    std::function<void(int, int)> hop = [&](int id, int n) {
+        Obj<Processor>& obj = *objs[id];
+        assert(obj.strand.runningInThisThread());
+        obj.received++;
+        if (n == kHops) {
+            done.notify();
+            return;
+        }
+        Obj<Processor>& next = *objs[(id * 7 + 1) % kNumObjs];
+        next.strand.post([&hop, &next, n] { hop(next.id, n + 1); });
+    };
+
+    auto start = nowMs();
+    for (int i = 0; i < kNumChains; i++) {
+        Obj<Processor>& obj = *objs[i * kNumObjs / kNumChains];
+        obj.strand.post([&hop, &obj] { hop(obj.id, 1); });
+    }
+    for (int i = 0; i < kNumChains; i++)
+        done.wait();
+    double ms = nowMs() - start;
+    stop();
+    return ms;
+}
+
+}  // namespace
+
+void shardedSample() {
+    double total = double(kNumChains) * kHops;
+    printf("%d objects, %d message chains of %d hops, %d threads\n", kNumObjs,
+           kNumChains, kHops, kNumThreads);
+
+    double ms;
+    {
+        WorkQueue wq;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; i++)
+            threads.push_back(std::thread([&wq] { wq.run(); }));
+        ms = hops<WorkQueue>([&](int) -> WorkQueue& { return wq; },
+                             [&] {
+                                 wq.stop();
+                                 for (auto&& t : threads)
+                                     t.join();
+                             });
+    }
+    printf("Strand<WorkQueue>              : %7.2fms, %6.3fus per hop\n", ms,
+           ms * 1000 / total);
+
+    {
+        ShardedExecutor::Options opts;
+        opts.numShards = kNumThreads;
+        ShardedExecutor executor(opts);
+        ms = hops<ShardedExecutor::Shard>(
+            [&](int id) -> ShardedExecutor::Shard& {
+                return executor.shardFor(id);
+            },
+            [&] { executor.stop(); });
+    }
+    printf("Strand<ShardedExecutor::Shard> : %7.2fms, %6.3fus per hop\n", ms,
+           ms * 1000 / total);
+}
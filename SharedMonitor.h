@@ -0,0 +1,149 @@
+#pragma once
+#include "Locks.h"
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+
+//
+// Monitor for read-mostly data (e.g: configuration, routing tables), which
+// lets readers run concurrently.
+//
+//	SharedMonitor<Routes> routes;
+//	auto dst = routes.read([&](const Routes& r) { return r.lookup(key); });
+//	routes.write([&](Routes& r) { r.add(key, dst); });
+//
+// "Lock" can be any SharedLockable (e.g: std::shared_timed_mutex), with
+// ScalableRWLock as the default.
+//
+// With SeqLock as the "Lock", readers don't write to any shared cache line at
+// all (see the specialization below).
+//
+template <class T, class Lock = ScalableRWLock>
+class SharedMonitor {
+public:
+    using Type = T;
+    SharedMonitor() {}
+    SharedMonitor(T t_) : m_t(std::move(t_)) {}
+
+    // Calls "f(const T&)", concurrently with other readers
+    template <typename F>
+    auto read(F f) const -> decltype(f(std::declval<const T&>())) {
+        std::shared_lock<Lock> hold(m_lock);
+        return f(static_cast<const T&>(m_t));
+    }
+
+    // Calls "f(T&)", with exclusive access
+    template <typename F>
+    auto write(F f) -> decltype(f(std::declval<T&>())) {
+        std::lock_guard<Lock> hold(m_lock);
+        return f(m_t);
+    }
+
+private:
+    T m_t;
+    mutable Lock m_lock;
+};
+
+// Selects the seqlock SharedMonitor
+struct SeqLock {};
+
+//
+// Seqlock version, for small trivially copyable (and default constructible)
+// types.
+// Writers bump a sequence number before and after changing the data, and
+// readers copy the data out, retrying if the sequence number changed (or was
+// odd) meanwhile. So readers never write to shared memory, but they work on a
+// copy, and can be starved by a constant stream of writes.
+// The data is stored as atomic words, so the concurrent copies are well
+// defined.
+//
+template <class T>
+class SharedMonitor<T, SeqLock> {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock requires a trivially copyable type");
+    // Readers and writers copy the data out into a default constructed T
+    static_assert(std::is_default_constructible<T>::value,
+                  "SeqLock requires a default constructible type");
+
+public:
+    using Type = T;
+    SharedMonitor() : SharedMonitor(T()) {}
+    SharedMonitor(T t_) {
+        store(t_);
+    }
+
+    // Calls "f(const T&)" with a consistent copy of the data, outside of any
+    // lock
+    template <typename F>
+    auto read(F f) const -> decltype(f(std::declval<const T&>())) {
+        const T copy = load();
+        return f(copy);
+    }
+
+    // Calls "f(T&)" with a copy of the data, and publishes the changes once
+    // it returns. Writers are serialized with a lock.
+    template <typename F>
+    auto write(F f) -> decltype(f(std::declval<T&>())) {
+        std::lock_guard<FutexLock> hold(m_writers);
+        Publisher publisher(*this);
+        return f(publisher.t);
+    }
+
+private:
+    static const size_t kNumWords = (sizeof(T) + 7) / 8;
+
+    // Copies the data out, and publishes it when destroyed (including after
+    // the writer's function returned a value)
+    struct Publisher {
+        explicit Publisher(SharedMonitor& owner) : owner(owner) {
+            // We are the only writer, so we can't see a write in progress
+            owner.copyOut(t);
+        }
+        ~Publisher() {
+            uint64_t seq = owner.m_seq.load(std::memory_order_relaxed);
+            owner.m_seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            owner.store(t);
+            owner.m_seq.store(seq + 2, std::memory_order_release);
+        }
+        SharedMonitor& owner;
+        T t;
+    };
+
+    T load() const {
+        T t;
+        detail::Backoff backoff;
+        while (true) {
+            uint64_t seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                backoff.pause();
+                continue;
+            }
+            copyOut(t);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == seq)
+                return t;
+        }
+    }
+
+    void copyOut(T& t) const {
+        uint64_t words[kNumWords];
+        for (size_t i = 0; i < kNumWords; i++)
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        memcpy(&t, words, sizeof(T));
+    }
+
+    void store(const T& t) {
+        uint64_t words[kNumWords] = {};
+        memcpy(words, &t, sizeof(T));
+        for (size_t i = 0; i < kNumWords; i++)
+            m_words[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> m_seq{0};
+    std::atomic<uint64_t> m_words[kNumWords];
+    FutexLock m_writers;
+};
@@ -0,0 +1,95 @@
+#include "Monitor.h"
+#include "SharedMonitor.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 32;
+const int kOpsPerThread = 100000;
+// One in this many operations is a write
+const int kWriteEvery = 100;
+
+// Read-mostly state. Writers keep all the entries equal, so readers can check
+// they never see a partial write.
+struct Routes {
+    uint64_t entries[8];
+};
+
+inline uint64_t readRoutes(const Routes& r, int& torn) {
+    uint64_t sum = 0;
+    for (auto&& e : r.entries) {
+        sum += e;
+        if (e != r.entries[0])
+            torn++;
+    }
+    return sum;
+}
+
+inline void writeRoutes(Routes& r) {
+    for (auto&& e : r.entries)
+        e++;
+}
+
+// Adapts Monitor to the read/write interface
+struct PlainMonitor {
+    explicit PlainMonitor(Routes r) : m(r) {}
+    template <typename F>
+    auto read(F f) {
+        return m([&](Routes& r) { return f(r); });
+    }
+    template <typename F>
+    auto write(F f) {
+        return m(f);
+    }
+    Monitor<Routes> m;
+};
+
+template <typename M>
+void run(const char* name) {
+    M routes(Routes{});
+    std::atomic<int> torn(0);
+    std::atomic<uint64_t> checksum(0);
+    std::vector<std::thread> threads;
+    auto start = nowMs();
+    for (int t = 0; t < kNumThreads; t++) {
+        threads.push_back(std::thread([&] {
+            int myTorn = 0;
+            uint64_t sum = 0;
+            for (int i = 1; i <= kOpsPerThread; i++) {
+                if (i % kWriteEvery == 0) {
+                    routes.write([](Routes& r) { writeRoutes(r); });
+                } else {
+                    sum += routes.read(
+                        [&](const Routes& r) { return readRoutes(r, myTorn); });
+                }
+            }
+            torn += myTorn;
+            checksum += sum;
+        }));
+    }
+    for (auto&& t : threads)
+        t.join();
+    auto elapsed = nowMs() - start;
+
+    double ops = double(kNumThreads) * kOpsPerThread;
+    printf("%-38s: %8.2fms, %7.2f Mops/s, %d torn reads\n", name, elapsed,
+           ops / elapsed / 1000, torn.load());
+}
+
+}  // namespace
+
+void sharedMonitorSample() {
+    printf("%d threads, %d operations each, %d%% reads\n", kNumThreads,
+           kOpsPerThread, 100 - 100 / kWriteEvery);
+    run<PlainMonitor>("Monitor<Routes>");
+    run<SharedMonitor<Routes, std::shared_timed_mutex>>(
+        "SharedMonitor<std::shared_timed_mutex>");
+    run<SharedMonitor<Routes>>("SharedMonitor<ScalableRWLock>");
+    run<SharedMonitor<Routes, SeqLock>>("SharedMonitor<SeqLock>");
+}
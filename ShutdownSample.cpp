@@ -0,0 +1,107 @@
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 8;
+const int kPending = 1000000;
+
+// Time from asking the workers to stop, to all of them exiting, with
+// "pending" items queued
+void run(WorkQueue::StopMode mode, int pending) {
+    WorkQueue workQueue;
+    std::atomic<int> executed(0);
+    // Queue the items before starting the workers, so they are all pending
+    for (int i = 0; i < pending; i++)
+        workQueue.push([&executed] { executed++; });
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+
+    auto start = nowMs();
+    size_t discarded = workQueue.stop(mode);
+    for (auto&& t : workerThreads)
+        t.join();
+    auto elapsed = nowMs() - start;
+
+    printf("%-5s, %7d pending: %8.2fms, %7d executed, %7zu discarded\n",
+           mode == WorkQueue::StopMode::Drain ? "Drain" : "Abort", pending,
+           elapsed, executed.load(), discarded);
+}
+
+// Same as above, but using the queue's own pool, and "stopAndJoin"
+void runPool(WorkQueue::StopMode mode, int pending) {
+    WorkQueue workQueue;
+    std::atomic<int> executed(0);
+    for (int i = 0; i < pending; i++)
+        workQueue.push([&executed] { executed++; });
+    WorkQueue::PoolOptions opts;
+    opts.minThreads = opts.maxThreads = kNumThreads;
+    workQueue.startPool(opts);
+
+    auto start = nowMs();
+    bool joined = workQueue.stopAndJoin(mode, 10000);
+    auto elapsed = nowMs() - start;
+
+    auto stats = workQueue.stats()[Priority::Normal];
+    printf("%-5s, %7d pending, pool: %8.2fms (%s), %7d executed, %7llu "
+           "discarded\n",
+           mode == WorkQueue::StopMode::Drain ? "Drain" : "Abort", pending,
+           elapsed, joined ? "joined" : "timed out", executed.load(),
+           static_cast<unsigned long long>(stats.discarded));
+}
+
+// While draining, a busy worker pushes an item and waits for it, so it can
+// only complete if the idle worker didn't exit in the meantime. The queue is
+// stopped by pushing an empty work item.
+void followUp() {
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < 2; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+
+    cz::Semaphore started;
+    std::atomic<bool> followUpDone(false);
+    double waitedMs = 0;
+    workQueue.push([&] {
+        started.notify();
+        // Give the idle worker time to see the stop
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        workQueue.defer([&] { followUpDone = true; });
+        auto start = nowMs();
+        while (!followUpDone && nowMs() - start < 1000)
+            std::this_thread::yield();
+        waitedMs = nowMs() - start;
+    });
+    started.wait();
+    workQueue.push(nullptr);
+    for (auto&& t : workerThreads)
+        t.join();
+
+    printf("Follow-up pushed by a busy worker while draining: %s after "
+           "%.2fms\n",
+           followUpDone ? "executed" : "not executed", waitedMs);
+    assert(followUpDone && waitedMs < 1000);
+}
+
+}  // namespace
+
+void shutdownSample() {
+    printf("%d threads\n", kNumThreads);
+    for (int pending : {0, kPending}) {
+        run(WorkQueue::StopMode::Drain, pending);
+        run(WorkQueue::StopMode::Abort, pending);
+    }
+    for (int pending : {0, kPending}) {
+        runPool(WorkQueue::StopMode::Drain, pending);
+        runPool(WorkQueue::StopMode::Abort, pending);
+    }
+    followUp();
+}
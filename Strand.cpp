@@ -2,12 +2,15 @@
 #include "Utils.h"
 #include "Strand.h"
 #include "Semaphore.h"
+#include "WaitGroup.h"
 
 #include <assert.h>
 #include <map>
 #include <iostream>
 #include <atomic>
 #include "WorkQueue.h"
+#include "LockProfiler.h"
+#include "PerWorker.h"
 
 #include <windows.h>
 #include "Remotery/lib/Remotery.h"
@@ -18,19 +21,40 @@ long ranged_rand(long a, long b)
 	return a + random_at_most(b - a);
 }
 
+// If 1, the WorkQueue creates its own pool of workers, which grows up to
+// POOL_MAX_THREADS when workers are blocked. In WHAT_NOSTRANDS, workers
+// blocked on an object's mutex are marked with a WorkQueue::BlockingScope, so
+// the pool adds compensating workers while they wait.
+#define USE_POOL 0
+
+#define NUM_THREADS 4
+#define POOL_MAX_THREADS 16
+#define NUM_OBJECTS 8
+#define WORKDURATION_MIN 5
+#define WORKDURATION_MAX 15
+
 struct ThreadInfo
 {
 	std::string name;
 	std::thread th;
 	double totalTime = 0;
+};
+
+// Time each worker spent in Foo's work, indexed by worker. Each worker only
+// updates its own slot, without sharing cache lines with the others.
+struct WorkerStats
+{
 	double totalWork = 0;
 	double totalBlocked = 0;
 };
+// Pool workers have indexes below POOL_MAX_THREADS
+PerWorker<WorkerStats> gWorkerStats(POOL_MAX_THREADS);
 
 Spinner gSpinner;
 
 struct Foo {
-	explicit Foo(int n, const char* colour, WorkQueue& wq) : strand(wq)
+	explicit Foo(int n, const char* colour, WorkQueue& wq)
+		: mtx("Conn " + std::to_string(n)), strand(wq)
 	{
 		name = "Conn " + std::to_string(n);
 		rmt_SetColour(name.c_str(), colour);
@@ -39,14 +63,18 @@ struct Foo {
 		using namespace std::chrono;
 
 		auto workStart = nowMs();
-		auto th = (*Callstack<ThreadInfo>::begin())->getKey();
+		auto& th = gWorkerStats.local();
 
 		rmt_BeginCPUSampleDynamic(name.c_str());
 
 		// Do the blocking, and time it
 		auto blockingStart = nowMs();
 		rmt_BeginCPUSample(Blocked);
-		mtx.lock();
+		{
+			// Lets the pool compensate for this worker while it blocks
+			WorkQueue::BlockingScope blocking;
+			mtx.lock();
+		}
 		rmt_EndCPUSample();
 		auto blockingEnd = nowMs();
 
@@ -63,15 +91,15 @@ struct Foo {
 		auto work = (workEnd - workStart) - blocked;
 		totalWork += work;
 		totalBlocked += blocked;
-		th->totalWork += work;
-		th->totalBlocked += blocked;
+		th.totalWork += work;
+		th.totalBlocked += blocked;
 	}
 
 	void doWorkUnlocked(int durationMs)
 	{
 		using namespace std::chrono;
 		auto workStart = nowMs();
-		auto th = (*Callstack<ThreadInfo>::begin())->getKey();
+		auto& th = gWorkerStats.local();
 
 		rmt_BeginCPUSampleDynamic(name.c_str());
 
@@ -85,14 +113,21 @@ struct Foo {
 
 		auto work = (workEnd - workStart);
 		totalWork += work;
-		th->totalWork += work;
+		th.totalWork += work;
 	}
 
-	std::mutex mtx;
+	// Read by every worker using the object, so it's kept apart from the
+	// lines they write to
 	std::string name;
+
+	// Build with CZ_LOCK_PROFILING=1 to get its contention stats.
+	// The counters are written by whichever worker just used the object, so
+	// they share the mutex's cache line.
+	alignas(kCacheLineSize) ProfiledLock<> mtx;
 	double totalWork = 0;
 	double totalBlocked = 0;
 
+	// Starts a cache line itself
 	Strand<WorkQueue> strand;
 };
 
@@ -101,15 +136,29 @@ struct Foo {
 #define WHAT_NOSTRANDS 1
 #define WHAT_STRANDS 2
 #define WHAT_SAMPLE 3
+#define WHAT_REACTOR 4
+#define WHAT_ASYNCFILE 5
+#define WHAT_PINGPONG 6
+#define WHAT_TASKGROUP 7
+#define WHAT_PARALLEL 8
+#define WHAT_QUEUES 9
+#define WHAT_SHARDED 10
+#define WHAT_YIELD 11
+#define WHAT_OVERLOAD 12
+#define WHAT_CONCURRENCY 13
+#define WHAT_SHUTDOWN 14
+#define WHAT_LOCKS 15
+#define WHAT_SHAREDMONITOR 16
+#define WHAT_COMBINING 17
+#define WHAT_ASYNCMONITOR 18
+#define WHAT_SEMAPHORE 19
+#define WHAT_ASYNCWAIT 20
+#define WHAT_FALSESHARING 21
+#define WHAT_NUMA 22
 
 // Set this to one of the above, to specify what code to run 
 #define WHAT WHAT_NOSTRANDS
 
-#define NUM_THREADS 4
-#define NUM_OBJECTS 8
-#define WORKDURATION_MIN 5
-#define WORKDURATION_MAX 15
-
 // Distinct colours generated with http://phrogz.net/css/distinct-colors.html
 #define NUM_COLOURS 44
 const char* distinctColours[44] = {
@@ -122,12 +171,88 @@ const char* distinctColours[44] = {
     "#1a1e33", "#1d331a"};
 
 void strandSample();
+void reactorSample();
+void asyncFileSample();
+void pingPongSample();
+void taskGroupSample();
+void parallelSample();
+void queueSample();
+void shardedSample();
+void yieldSample();
+void overloadSample();
+void concurrencySample();
+void shutdownSample();
+void lockSample();
+void sharedMonitorSample();
+void combiningSample();
+void asyncMonitorSample();
+void semaphoreSample();
+void asyncWaitSample();
+void falseSharingSample();
+void numaSample();
 
 int main()
 {
 #if WHAT==WHAT_SAMPLE
 	strandSample();
 	return 0;
+#elif WHAT==WHAT_REACTOR
+	reactorSample();
+	return 0;
+#elif WHAT==WHAT_ASYNCFILE
+	asyncFileSample();
+	return 0;
+#elif WHAT==WHAT_PINGPONG
+	pingPongSample();
+	return 0;
+#elif WHAT==WHAT_TASKGROUP
+	taskGroupSample();
+	return 0;
+#elif WHAT==WHAT_PARALLEL
+	parallelSample();
+	return 0;
+#elif WHAT==WHAT_QUEUES
+	queueSample();
+	return 0;
+#elif WHAT==WHAT_SHARDED
+	shardedSample();
+	return 0;
+#elif WHAT==WHAT_YIELD
+	yieldSample();
+	return 0;
+#elif WHAT==WHAT_OVERLOAD
+	overloadSample();
+	return 0;
+#elif WHAT==WHAT_CONCURRENCY
+	concurrencySample();
+	return 0;
+#elif WHAT==WHAT_SHUTDOWN
+	shutdownSample();
+	return 0;
+#elif WHAT==WHAT_LOCKS
+	lockSample();
+	return 0;
+#elif WHAT==WHAT_SHAREDMONITOR
+	sharedMonitorSample();
+	return 0;
+#elif WHAT==WHAT_COMBINING
+	combiningSample();
+	return 0;
+#elif WHAT==WHAT_ASYNCMONITOR
+	asyncMonitorSample();
+	return 0;
+#elif WHAT==WHAT_SEMAPHORE
+	semaphoreSample();
+	return 0;
+#elif WHAT==WHAT_ASYNCWAIT
+	asyncWaitSample();
+	return 0;
+#elif WHAT==WHAT_FALSESHARING
+	falseSharingSample();
+	return 0;
+#elif WHAT==WHAT_NUMA
+	numaSample();
+	return 0;
 #endif
 
 	time_t t;
@@ -142,26 +267,42 @@ int main()
 
 	std::vector<ThreadInfo> ths;
 	using namespace cz;
-	ZeroSemaphore threadsReady;
-	ZeroSemaphore threadsRunning;
-
+	WaitGroup threadsReady;
+	WaitGroup threadsRunning;
+
+#if USE_POOL
+	ths.resize(POOL_MAX_THREADS);
+	WorkQueue::PoolOptions poolOpts;
+	poolOpts.minThreads = NUM_THREADS;
+	poolOpts.maxThreads = POOL_MAX_THREADS;
+	poolOpts.workerEntry = [&ths](unsigned index, const std::function<void()>& run)
+	{
+		auto this_ = &ths[index];
+		this_->name = formatStr("WorkerThread %d", index);
+		rmt_SetCurrentThreadName(this_->name.c_str());
+		auto start = nowMs();
+		run();
+		this_->totalTime += nowMs() - start;
+	};
+	wq.startPool(poolOpts);
+#else
 	ths.resize(NUM_THREADS);
+	threadsReady.add(NUM_THREADS);
+	threadsRunning.add(NUM_THREADS);
 	for (int i = 0; i < NUM_THREADS; i++)
 	{
-		threadsReady.increment();
-		threadsRunning.increment();
 		ths[i].th = std::thread([&wq, &threadsReady, &threadsRunning, this_=&ths[i], i]
 		{
 			this_->name = formatStr("WorkerThread %d", i);
 			rmt_SetCurrentThreadName(this_->name.c_str());
-			threadsReady.decrement();
+			threadsReady.done();
 			auto start = nowMs();
-			Callstack<ThreadInfo>::Context ctx(this_);
 			wq.run();
-			threadsRunning.decrement();
+			threadsRunning.done();
 			this_->totalTime = nowMs() - start;
 		});
 	}
+#endif
 
 	std::vector<std::unique_ptr<Foo>> objs;
 	for (int i = 0; i < NUM_OBJECTS; i++)
@@ -202,14 +343,21 @@ int main()
 	for (auto&& item : items)
 		wq.push(std::move(item));
 	wq.stop();
+#if USE_POOL
+	wq.joinPool();
+#else
 	threadsRunning.wait();
+#endif
 	auto end = nowMs();
 
 	double mainThreadTotalTime = end - start;
 	assert(itemsDone.load() == itemsTodo);
 
 	for (auto&& t : ths)
-		t.th.join();
+	{
+		if (t.th.joinable())
+			t.th.join();
+	}
 
 	double totalWork = 0;
 	double totalBlocked = 0;
@@ -223,21 +371,56 @@ int main()
 
 	{
 		printf("THREADS\n");
-		double totalWork = 0;
-		double totalBlocked = 0;
 		double totalTime = 0;
 		for (auto& t : ths)
 		{
-			totalWork += t.totalWork;
-			totalBlocked += t.totalBlocked;
+			// Pool workers that were never created
+			if (t.totalTime == 0)
+				continue;
 			totalTime += t.totalTime;
-			printf("\t%s: totalTime=%5.2f totalWork=%5.2f totalOverhead=%3.2f%%\n",
-				t.name.c_str(), t.totalTime, t.totalWork, ((t.totalTime-t.totalWork) * 100) / (t.totalTime));
+			printf("\t%s: totalTime=%5.2f\n", t.name.c_str(), t.totalTime);
 		}
+		// Worker indexes are not necessarily the same as the thread numbers
+		printf("WORKERS\n");
+		for (unsigned i = 0; i < gWorkerStats.size(); i++)
+		{
+			const WorkerStats& w = gWorkerStats[i];
+			if (w.totalWork == 0)
+				continue;
+			printf("\tWorker %u: totalWork=%5.2f totalBlocked=%5.2f\n",
+				i, w.totalWork, w.totalBlocked);
+		}
+		double totalWork = gWorkerStats.combine(0.0, [](double acc, const WorkerStats& w)
+		{
+			return acc + w.totalWork;
+		});
 		printf("\tTOTAL: totalTime=%5.3f totalWork=%5.3f totalOverhead=%3.3f%%\n",
 			totalTime, totalWork, ((totalTime-totalWork) * 100) / (totalTime));
 	}
 
+#if USE_POOL
+	{
+		auto stats = wq.stats();
+		printf("POOL: threads=%u peakThreads=%u grown=%u retired=%u compensated=%u\n",
+			stats.pool.threads, stats.pool.peakThreads,
+			unsigned(stats.pool.grown), unsigned(stats.pool.retired),
+			unsigned(stats.pool.compensated));
+		const char* reasons[] = {"Start", "Starved", "Idle", "Blocking", "Unblocked"};
+		for (auto&& evt : wq.resizeEvents())
+			printf("\t%8.2fms: %-9s %u -> %u threads (oldest item waiting %5.2fms)\n",
+				evt.timeMs, reasons[int(evt.reason)], evt.fromThreads, evt.toThreads,
+				evt.oldestWaitMs);
+	}
+#endif
+
+#if CZ_LOCK_PROFILING
+	printf("LOCKS\n");
+	for (auto&& l : LockRegistry::snapshot())
+		printf("\t%s: acquisitions=%u contended=%3.2f%% totalWait=%5.2fms maxWait=%5.2fms totalHold=%5.2fms\n",
+			l.name.c_str(), unsigned(l.acquisitions), l.contendedRatio() * 100,
+			l.totalWaitMs, l.maxWaitMs, l.totalHoldMs);
+#endif
+
 	double totalOverhead = (1 - ((totalWork / NUM_THREADS) / mainThreadTotalTime)) * 100;
 	printf("MAINTHREAD: totaTime=%5.2f totalWork=%5.2f totalOverhead=%3.2f%%\n",
 		mainThreadTotalTime, totalWork, totalOverhead);
@@ -1,9 +1,18 @@
 #pragma once
+#include "CacheLine.h"
 #include "Callstack.h"
+#include "Continuation.h"
+#include "Deadline.h"
 #include "Monitor.h"
+#include "Priority.h"
 #include <assert.h>
+#include <stdint.h>
+#include <atomic>
 #include <queue>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
 
 //
 // A strand serializes handler execution.
@@ -12,21 +21,65 @@
 // - Handlers are only executed from the specified Processor
 // - Handler execution order is not guaranteed
 //
+// Long running handlers can give up their worker partway through, by returning
+// a Continuation (see Continuation.h), or with "defer". The rest of the work is
+// enqueued at the back of the strand, and the strand pushes a new run to the
+// Processor, so other work queued in the Processor gets a turn. The strand
+// stays marked as running meanwhile, so the guarantees above still hold.
+//
+// Handlers posted with a Deadline are skipped if the strand doesn't get to them
+// in time, and the deadline's "onExpired" callback executes instead.
+//
+// Handlers can be given a priority. The work item the strand pushes to the
+// Processor to execute its handlers inherits the highest priority of the
+// handlers it contains. If a more important handler is posted while that work
+// item is still queued, another copy is pushed with the higher priority. The
+// copies share a claim flag, and only the first one to execute touches the
+// strand, so the rest can outlive it, and the strand can be destroyed as soon
+// as all its handlers are executed.
+//
 // Specified Processor must implement the following interface:
 //
 //	template <typename F> void Processor::push(F w);
 //		Add a new work item to the processor. F is a callable convertible
 // to std::function<void()>
 //
+//	template <typename F> void Processor::push(F w, Priority prio);
+//		Optional. Same as above, but with a priority. If not available,
+// handler priorities are ignored.
+//
+//	template <typename F> void Processor::defer(F w, Priority prio);
+//		Optional. Same as above, but the work item goes behind anything
+// already queued. Used when a handler yields. If not available, "push" is used.
+//
 //	bool Processor::canDispatch();
 //		Should return true if we are in the Processor's dispatching function in
 // the current thread.
 //
-template <typename Processor>
+// "Lock" is the lock protecting the strand's state (see Monitor), which is
+// only held for a few instructions at a time. Spinning locks (see Locks.h) can
+// be cheaper than the default std::mutex for that.
+//
+template <typename Processor, typename Lock = std::mutex>
 class Strand {
 public:
     Strand(Processor& proc) : m_proc(proc) {}
 
+    // Any extra arguments are passed to the lock's constructor (e.g: the name
+    // of a ProfiledLock)
+    template <typename... LockArgs>
+    Strand(Processor& proc, LockArgs&&... lockArgs)
+        : m_data(Data(), std::forward<LockArgs>(lockArgs)...), m_proc(proc) {}
+
+    ~Strand() {
+        // A run still queued in the processor would execute once the strand is
+        // gone. Runs the processor discarded (e.g: when aborting) release their
+        // claim flag, so they don't trip this.
+        assert(m_data([](const Data& data) {
+            return !data.pending || data.pending.use_count() == 1;
+        }));
+    }
+
     Strand(const Strand&) = delete;
     Strand& operator=(const Strand&) = delete;
 
@@ -34,12 +87,80 @@ public:
     // or posts the handler for later execution if the guarantees are not met
     // from inside this call
     template <typename F>
-    void dispatch(F handler) {
+    void dispatch(F handler, Priority prio = Priority::Normal) {
+        auto h = wrap(std::move(handler), detail::returnsContinuation<F>());
+        dispatchImpl(std::move(h), prio);
+    }
+
+    // Post an handler for execution and returns immediately.
+    // The handler is never executed as part of this call.
+    template <typename F>
+    void post(F handler, Priority prio = Priority::Normal) {
+        auto h = wrap(std::move(handler), detail::returnsContinuation<F>());
+        // We atomically enqueue the handler AND check if we need to start the
+        // running process.
+        RunClaim trigger = m_data([&](Data& data) {
+            data.q.push(std::move(h));
+            return schedule(data, prio);
+        });
+
+        // The strand was not running (or needs a higher priority), so trigger
+        // a run
+        if (trigger) {
+            pushRun(std::move(trigger), prio);
+        }
+    }
+
+    // Same as "post", but the handler is skipped if it doesn't start by the
+    // deadline
+    template <typename F>
+    void post(F handler, Deadline deadline, Priority prio = Priority::Normal) {
+        auto next = detail::toContinuation(std::move(handler));
+        post(
+            [this, next, deadline]() mutable -> Continuation {
+                if (!deadline.expired(Deadline::Clock::now()))
+                    return next();
+                m_expired.fetch_add(1, std::memory_order_relaxed);
+                if (deadline.onExpired)
+                    deadline.onExpired();
+                return {};
+            },
+            prio);
+    }
+
+    // Number of handlers skipped due to their deadline
+    uint64_t expired() const {
+        return m_expired.load(std::memory_order_relaxed);
+    }
+
+    // Same as "post", but if called from one of this strand's handlers, the
+    // strand also gives up its worker once the current handler returns.
+    template <typename F>
+    void defer(F handler, Priority prio = Priority::Normal) {
+        if (runningInThisThread())
+            yieldLater(detail::toContinuation(std::move(handler)));
+        else
+            post(std::move(handler), prio);
+    }
+
+    // Checks if we are currently running the strand in this thread
+    bool runningInThisThread() {
+        return Callstack<Strand>::contains(this) != nullptr;
+    }
+
+private:
+    struct Data;
+    // Shared by the copies of a run pushed to the processor. Set by the first
+    // one to execute.
+    using RunClaim = std::shared_ptr<std::atomic<bool>>;
+
+    template <typename F>
+    void dispatchImpl(F handler, Priority prio) {
         // If we are not currently in the processor dispatching function (in
         // this thread), then we cannot possibly execute the handler here, so
         // enqueue it and bail out
         if (!m_proc.canDispatch()) {
-            post(std::move(handler));
+            post(std::move(handler), prio);
             return;
         }
 
@@ -59,20 +180,26 @@ public:
         // The strand can still be running in another worker thread, so we need
         // to atomically enqueue the handler for the other thread to execute OR
         // mark the strand as running in this thread
+        RunClaim reschedule;
         auto trigger = m_data([&](Data& data) {
             if (data.running) {
                 data.q.push(std::move(handler));
+                reschedule = schedule(data, prio);
                 return false;
             } else {
                 data.running = true;
+                data.executing = true;
+                data.scheduled = prio;
                 return true;
             }
         });
 
-        if (trigger) {
+        if (reschedule) {
+            pushRun(std::move(reschedule), prio);
+        } else if (trigger) {
             // Add a marker to the callstack, so the handler knows the strand is
             // running in the current thread
-            Callstack<Strand>::Context ctx(this);
+            typename Callstack<Strand>::Context ctx(this);
             handler();
 
             // Run any remaining handlers.
@@ -84,63 +211,141 @@ public:
         }
     }
 
-    // Post an handler for execution and returns immediately.
-    // The handler is never executed as part of this call.
+    // Handlers returning a Continuation hand it to the strand once they
+    // return
     template <typename F>
-    void post(F handler) {
-        // We atomically enqueue the handler AND check if we need to start the
-        // running process.
-        bool trigger = m_data([&](Data& data) {
-            data.q.push(std::move(handler));
-            if (data.running) {
-                return false;
-            } else {
-                data.running = true;
-                return true;
-            }
-        });
+    std::function<void()> wrap(F handler, std::true_type) {
+        return [this, handler]() mutable { yieldLater(handler()); };
+    }
 
-        // The strand was not running, so trigger a run
-        if (trigger) {
-            m_proc.push([this] { run(); });
+    template <typename F>
+    F wrap(F handler, std::false_type) {
+        return handler;
+    }
+
+    // Makes the strand give up its worker once the current handler returns,
+    // and execute "next" later.
+    // Only called from the thread executing the strand.
+    void yieldLater(Continuation next) {
+        if (!next)
+            return;
+        if (m_yield)
+            post(std::move(next));
+        else
+            m_yield = std::move(next);
+    }
+
+    // Marks the strand as running after enqueuing a handler with the
+    // specified priority.
+    // Returns the claim flag of the run to push to the processor with that
+    // priority, or nullptr if none is needed.
+    static RunClaim schedule(Data& data, Priority prio) {
+        if (!data.running) {
+            data.running = true;
+            data.scheduled = prio;
+            data.pending = std::make_shared<std::atomic<bool>>(false);
+            return data.pending;
+        }
+
+        // A run is already pushed to the processor. If no thread picked it up
+        // yet, and this handler is more important, push another copy of it
+        // with the higher priority. Whichever executes first claims the run
+        // and processes the handlers, and the other one returns without
+        // touching the strand.
+        if (data.pending && prio > data.scheduled) {
+            data.scheduled = prio;
+            return data.pending;
         }
+
+        return nullptr;
     }
 
-    // Checks if we are currently running the strand in this thread
-    bool runningInThisThread() {
-        return Callstack<Strand>::contains(this) != nullptr;
+    void pushRun(RunClaim claim, Priority prio) {
+        detail::pushWithPriority(m_proc, runItem(std::move(claim)), prio);
+    }
+
+    // Work item pushed to the processor. The strand is only touched by the
+    // copy that claims the run, since the others can execute after it's
+    // destroyed.
+    std::function<void()> runItem(RunClaim claim) {
+        return [this, claim] {
+            if (!claim->exchange(true, std::memory_order_acq_rel))
+                runScheduled();
+        };
+    }
+
+    void runScheduled() {
+        m_data([](Data& data) {
+            assert(data.running && !data.executing);
+            data.executing = true;
+            data.pending = nullptr;
+        });
+        run();
     }
 
-private:
     // Processes any enqueued handlers.
-    // This assumes the strand is marked as running.
+    // This assumes the strand is marked as running and executing.
     // When there are no more handlers, it marks the strand as not running.
     void run() {
-        Callstack<Strand>::Context ctx(this);
+        typename Callstack<Strand>::Context ctx(this);
         while (true) {
             std::function<void()> handler;
+            RunClaim yield;
+            Priority prio = Priority::Normal;
             m_data([&](Data& data) {
-                assert(data.running);
-                if (data.q.size()) {
+                assert(data.running && data.executing);
+                if (m_yield) {
+                    // The last handler yielded, so enqueue the rest of its
+                    // work at the back, and push a new run with the same
+                    // priority as the current one. The strand stays marked as
+                    // running, so nothing else executes it meanwhile.
+                    data.q.push(wrap(std::move(m_yield), std::true_type()));
+                    m_yield = Continuation();
+                    data.executing = false;
+                    data.pending = std::make_shared<std::atomic<bool>>(false);
+                    prio = data.scheduled;
+                    yield = data.pending;
+                } else if (data.q.size()) {
                     handler = std::move(data.q.front());
                     data.q.pop();
                 } else {
                     data.running = false;
+                    data.executing = false;
                 }
             });
 
-            if (handler)
+            if (yield) {
+                detail::deferWithPriority(
+                    m_proc, runItem(std::move(yield)), prio);
+                return;
+            } else if (handler) {
                 handler();
-            else
+            } else {
                 return;
+            }
         }
     }
 
     struct Data {
+        // A run is pushed to the processor, or the handlers are being executed
         bool running = false;
+        // A thread is executing the handlers
+        bool executing = false;
+        // Priority of the current run. Raised while the run is still queued
+        // if a more important handler is posted.
+        Priority scheduled = Priority::Low;
+        // Claim flag of the run queued in the processor, if it didn't start
+        // yet
+        RunClaim pending;
         std::queue<std::function<void()>> q;
     };
-    Monitor<Data> m_data;
+    // Written by any thread posting handlers, so it starts a cache line, not
+    // shared with whatever is allocated before the strand
+    alignas(kCacheLineSize) Monitor<Data, Lock> m_data;
     Processor& m_proc;
+    // Continuation of the handler that just yielded. Only used by the thread
+    // executing the strand, so it's kept apart from m_data.
+    alignas(kCacheLineSize) Continuation m_yield;
+    std::atomic<uint64_t> m_expired{0};
 };
 
@@ -0,0 +1,158 @@
+#pragma once
+#include "Priority.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+//
+// Fork-join group of tasks, executed by a Processor (see Strand.h for the
+// interface).
+//
+// "spawn" pushes tasks to the Processor, and "wait" blocks until all the
+// spawned tasks (including any they spawn themselves) finish. If "wait" is
+// called from one of the Processor's workers, it executes the group's pending
+// tasks itself instead of sleeping, so tasks can wait on nested groups
+// without tying up the workers.
+//
+// If a task throws, tasks not started yet are skipped, and "wait" rethrows the
+// first exception.
+//
+// Once "wait" returns, the group can be reused.
+//
+template <typename Processor>
+class TaskGroup {
+public:
+    explicit TaskGroup(Processor& proc) : m_proc(proc) {}
+
+    // Waits for any pending tasks, ignoring exceptions
+    ~TaskGroup() {
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // Can be called from any thread, but not concurrently with "wait", unless
+    // from one of the group's tasks.
+    template <typename F>
+    void spawn(F f, Priority prio = Priority::Normal) {
+        Task* t = new Task(std::move(f));
+        m_pending.fetch_add(1);
+        t->next = m_head.load(std::memory_order_relaxed);
+        while (!m_head.compare_exchange_weak(t->next, t,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+        }
+
+        // Whoever claims the task first executes it, the Processor or a
+        // waiting worker. Deferred rather than pushed, so a task spawned from
+        // a worker goes to the shared queue where idle workers take it right
+        // away, instead of the spawning worker's LIFO slot (see WorkQueue).
+        detail::deferWithPriority(m_proc,
+                                  [this, t] {
+                                      if (claim(t))
+                                          execute(t);
+                                      release(t);
+                                  },
+                                  prio);
+    }
+
+    void wait() {
+        if (m_proc.canDispatch())
+            help();
+
+        // The group itself holds one count, so only the last task to finish
+        // (if any) signals us
+        if (m_pending.fetch_sub(1) != 1) {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond.wait(lock, [this] { return m_done; });
+            m_done = false;
+        }
+        m_pending = 1;
+
+        Task* t = m_head.exchange(nullptr);
+        while (t) {
+            Task* next = t->next;
+            release(t);
+            t = next;
+        }
+
+        m_cancelled = false;
+        std::exception_ptr error;
+        std::swap(error, m_error);
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct Task {
+        explicit Task(std::function<void()> fn_) : fn(std::move(fn_)) {}
+        std::function<void()> fn;
+        std::atomic<bool> claimed{false};
+        // Held by the group's list and the work item pushed to the Processor
+        std::atomic<int> refs{2};
+        Task* next = nullptr;
+    };
+
+    static bool claim(Task* t) {
+        return !t->claimed.load(std::memory_order_relaxed) &&
+               !t->claimed.exchange(true, std::memory_order_acquire);
+    }
+
+    static void release(Task* t) {
+        if (t->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete t;
+    }
+
+    void execute(Task* t) {
+        if (!m_cancelled.load(std::memory_order_relaxed)) {
+            try {
+                t->fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (!m_error)
+                    m_error = std::current_exception();
+                m_cancelled = true;
+            }
+        }
+        // Release the captures right away
+        t->fn = nullptr;
+
+        if (m_pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_done = true;
+            m_cond.notify_one();
+        }
+    }
+
+    // Executes any unclaimed tasks, newest first, until there are none left
+    void help() {
+        Task* end = nullptr;
+        while (true) {
+            Task* head = m_head.load(std::memory_order_acquire);
+            if (head == end)
+                break;
+            for (Task* t = head; t != end; t = t->next) {
+                if (claim(t))
+                    execute(t);
+            }
+            end = head;
+        }
+    }
+
+    Processor& m_proc;
+    // Spawned tasks, newest first
+    std::atomic<Task*> m_head{nullptr};
+    // Number of unfinished tasks, plus one held by the group until "wait"
+    std::atomic<int> m_pending{1};
+    std::atomic<bool> m_cancelled{false};
+    std::mutex m_mtx;
+    std::condition_variable m_cond;
+    bool m_done = false;
+    std::exception_ptr m_error;
+};
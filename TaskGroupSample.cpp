@@ -0,0 +1,87 @@
+#include "TaskGroup.h"
+#include "WorkQueue.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Below this, ranges are summed serially
+const size_t kGrain = 10000;
+
+// Splits the range in two, and sums the halves in parallel. Every level waits
+// on its own group from inside a worker, which only works because waiting
+// workers execute the group's tasks instead of blocking.
+uint64_t parallelSum(WorkQueue& wq, const uint32_t* data, size_t size) {
+    if (size <= kGrain)
+        return std::accumulate(data, data + size, uint64_t(0));
+
+    size_t half = size / 2;
+    uint64_t left = 0, right = 0;
+    TaskGroup<WorkQueue> group(wq);
+    group.spawn([&] { left = parallelSum(wq, data, half); });
+    group.spawn([&] { right = parallelSum(wq, data + half, size - half); });
+    group.wait();
+    return left + right;
+}
+
+}  // namespace
+
+void taskGroupSample() {
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < 4; i++) {
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    }
+
+    std::vector<uint32_t> data(10000000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint32_t>(i % 1000);
+    auto start = nowMs();
+    uint64_t expected = std::accumulate(data.begin(), data.end(), uint64_t(0));
+    auto serialMs = nowMs() - start;
+
+    // Start from inside a worker, so the top level wait helps too
+    cz::Semaphore done;
+    uint64_t sum = 0;
+    double parallelMs = 0;
+    workQueue.push([&] {
+        auto start = nowMs();
+        sum = parallelSum(workQueue, data.data(), data.size());
+        parallelMs = nowMs() - start;
+        done.notify();
+    });
+    done.wait();
+    printf("Sum %llu: serial %5.2fms, parallel %5.2fms\n",
+           static_cast<unsigned long long>(sum), serialMs, parallelMs);
+    assert(sum == expected);
+
+    // The first exception is rethrown by "wait", and tasks not started yet
+    // are skipped
+    TaskGroup<WorkQueue> group(workQueue);
+    std::atomic<int> executed(0);
+    for (int i = 0; i < 100; i++) {
+        group.spawn([&executed, i] {
+            executed++;
+            if (i == 10)
+                throw std::runtime_error("Task 10 failed");
+        });
+    }
+    try {
+        group.wait();
+    } catch (std::exception& e) {
+        printf("Caught \"%s\", after executing %d tasks out of 100\n", e.what(),
+               executed.load());
+    }
+
+    workQueue.stop();
+    for (auto&& t : workerThreads) {
+        t.join();
+    }
+}
@@ -0,0 +1,149 @@
+#include "Topology.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+bool readLine(const std::string& path, std::string& out) {
+    std::ifstream f(path);
+    return f && std::getline(f, out);
+}
+
+#if defined(_WIN32)
+Topology discoverWin32() {
+    Topology res;
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest))
+        return res;
+    for (ULONG n = 0; n <= highest; n++) {
+        ULONGLONG mask = 0;
+        if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(n), &mask) || !mask)
+            continue;
+        NumaNode node;
+        node.id = static_cast<int>(n);
+        for (int cpu = 0; cpu < 64; cpu++) {
+            if (mask & (1ULL << cpu))
+                node.cpus.push_back(cpu);
+        }
+        res.nodes.push_back(std::move(node));
+    }
+    return res;
+}
+#endif
+
+}  // namespace
+
+std::vector<int> parseCpuList(const std::string& str) {
+    std::vector<int> res;
+    std::stringstream ss(str);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n")
+            continue;
+        char* end = nullptr;
+        long first = strtol(range.c_str(), &end, 10);
+        if (end == range.c_str())
+            continue;
+        long last = first;
+        if (*end == '-')
+            last = strtol(end + 1, nullptr, 10);
+        for (long cpu = first; cpu <= last; cpu++)
+            res.push_back(static_cast<int>(cpu));
+    }
+    return res;
+}
+
+Topology Topology::fromSysfs(const std::string& nodeDir) {
+    Topology res;
+
+    // "online" lists the node ids in the same format as a cpulist. If not
+    // available, probe for contiguous node ids.
+    std::string line;
+    std::vector<int> ids;
+    if (readLine(nodeDir + "/online", line)) {
+        ids = parseCpuList(line);
+    } else {
+        for (int id = 0; readLine(nodeDir + "/node" + std::to_string(id) +
+                                      "/cpulist",
+                                  line);
+             id++)
+            ids.push_back(id);
+    }
+
+    for (int id : ids) {
+        if (!readLine(nodeDir + "/node" + std::to_string(id) + "/cpulist",
+                      line))
+            continue;
+        NumaNode node;
+        node.id = id;
+        node.cpus = parseCpuList(line);
+        // Memory only nodes have no CPUs, so no workers can live there
+        if (node.cpus.size())
+            res.nodes.push_back(std::move(node));
+    }
+
+    return res;
+}
+
+Topology Topology::singleNode(unsigned numCpus) {
+    if (numCpus == 0)
+        numCpus = std::thread::hardware_concurrency();
+    if (numCpus == 0)
+        numCpus = 1;
+    Topology res;
+    res.nodes.resize(1);
+    for (unsigned i = 0; i < numCpus; i++)
+        res.nodes[0].cpus.push_back(static_cast<int>(i));
+    return res;
+}
+
+Topology Topology::discover() {
+    Topology res;
+#if defined(_WIN32)
+    res = discoverWin32();
+#elif defined(__linux__)
+    res = fromSysfs("/sys/devices/system/node");
+#endif
+    if (res.nodes.empty())
+        res = singleNode();
+    return res;
+}
+
+size_t Topology::numCpus() const {
+    size_t res = 0;
+    for (auto&& node : nodes)
+        res += node.cpus.size();
+    return res;
+}
+
+bool pinCurrentThread(const std::vector<int>& cpus) {
+    if (cpus.empty())
+        return false;
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus) {
+        if (cpu < static_cast<int>(sizeof(mask) * 8))
+            mask |= DWORD_PTR(1) << cpu;
+    }
+    return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+
+//
+// CPU/NUMA topology of the machine
+//
+struct NumaNode {
+    int id = 0;
+    // Logical CPUs belonging to this node
+    std::vector<int> cpus;
+};
+
+struct Topology {
+    std::vector<NumaNode> nodes;
+
+    // Discovers the machine's topology.
+    // On Linux, this reads "/sys/devices/system/node". If the topology can't
+    // be discovered, it falls back to "singleNode()".
+    static Topology discover();
+
+    // Reads the topology from a sysfs-like directory, containing "nodeN"
+    // subdirectories with a "cpulist" file each (e.g: "0-3,8-11").
+    // Returns an empty topology if nothing is found.
+    static Topology fromSysfs(const std::string& nodeDir);
+
+    // Synthetic topology with a single node, containing "numCpus" CPUs.
+    // If "numCpus" is 0, it uses std::thread::hardware_concurrency()
+    static Topology singleNode(unsigned numCpus = 0);
+
+    size_t numCpus() const;
+};
+
+// Parses a Linux cpulist string (e.g: "0-3,8,10-11")
+std::vector<int> parseCpuList(const std::string& str);
+
+// Pins the calling thread to the specified CPUs.
+// Returns false if pinning failed or is not supported on this platform.
+bool pinCurrentThread(const std::vector<int>& cpus);
@@ -1,4 +1,13 @@
 #include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <stdio.h>
 #include <stdlib.h>  // For random(), RAND_MAX
 
 #pragma once
@@ -32,6 +41,69 @@ inline double nowMs() {
     return duration<double, std::milli>(steady_clock::now() - start).count();
 }
 
+//
+// Latencies of handlers, from when they were posted to when they executed
+struct Latencies {
+    void add(double ms) {
+        std::lock_guard<std::mutex> lock(mtx);
+        count++;
+        total += ms;
+        max = std::max(max, ms);
+    }
+
+    double avg() const {
+        return count ? total / count : 0;
+    }
+
+    std::mutex mtx;
+    int count = 0;
+    double total = 0;
+    double max = 0;
+};
+
+//
+// Posts a short handler every "tickMs", to each of the strands in turn, from a
+// thread of its own, until stopped. The samples use it to show how long short
+// handlers wait while the workers are busy with something else.
+template <typename Strand>
+class Ticker {
+public:
+    Ticker(const std::vector<std::unique_ptr<Strand>>& strands, double tickMs)
+        : m_th([this, &strands, tickMs] {
+              for (size_t n = 0; !m_stop; n++) {
+                  auto posted = nowMs();
+                  m_pending++;
+                  strands[n % strands.size()]->post([this, posted] {
+                      latencies.add(nowMs() - posted);
+                      m_pending--;
+                  });
+                  std::this_thread::sleep_for(
+                      std::chrono::duration<double, std::milli>(tickMs));
+              }
+          }) {}
+
+    ~Ticker() {
+        stop();
+    }
+
+    // Stops posting, and waits for the handlers already posted to execute
+    void stop() {
+        m_stop = true;
+        if (m_th.joinable())
+            m_th.join();
+        while (m_pending)
+            std::this_thread::yield();
+    }
+
+    Latencies latencies;
+
+private:
+    std::atomic<bool> m_stop{false};
+    std::atomic<int> m_pending{0};
+    // Last, so it starts once everything else is initialized
+    std::thread m_th;
+};
+
 //
 // Class to spin the CPU for a specified time.
 struct Spinner {
@@ -47,7 +119,7 @@ public:
     }
 
     void spinMs(unsigned int ms) {
-        spin(unsigned int(ms * countPerMs));
+        spin(static_cast<unsigned int>(ms * countPerMs));
     }
 
 private:
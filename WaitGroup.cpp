@@ -0,0 +1,121 @@
+#include "WaitGroup.h"
+#include "Futex.h"
+#include <assert.h>
+#include <iterator>
+
+namespace cz {
+
+namespace {
+// Layout of the state word
+const uint32_t kWaitersFlag = 1u << 31;
+const uint32_t kAsyncFlag = 1u << 30;
+const uint32_t kCountMask = kAsyncFlag - 1;
+}  // namespace
+
+void WaitGroup::add(unsigned int n) {
+    uint32_t prev = m_state.fetch_add(n, std::memory_order_relaxed);
+    assert((prev & kCountMask) + n <= kCountMask);
+    (void)prev;
+}
+
+void WaitGroup::done() {
+    std::vector<std::function<void()>> ready;
+    uint32_t state = m_state.load();
+    while (true) {
+        uint32_t count = state & kCountMask;
+        assert(count > 0);
+        if (count == 1 && (state & kAsyncFlag)) {
+            // Take the asynchronous waiters while the count is not zero yet,
+            // since the group can be destroyed once it is
+            takeAsyncWaiters(ready);
+            state = m_state.load();
+        } else if (count > 1 && ready.size()) {
+            // The count was increased meanwhile, so they wait for the next
+            // zero, as blocked waiters do
+            returnAsyncWaiters(ready);
+            state = m_state.load();
+        } else if (m_state.compare_exchange_weak(
+                       state, count == 1 ? 0 : state - 1,
+                       std::memory_order_acq_rel)) {
+            break;
+        }
+    }
+    if ((state & kCountMask) != 1)
+        return;
+    // Woken up threads can destroy the group, so only the word's address is
+    // used
+    if (state & kWaitersFlag)
+        futexWakeAll(m_state);
+    // Posted outside the lock
+    for (auto&& post : ready)
+        post();
+}
+
+void WaitGroup::wait() {
+    uint32_t state = m_state.load(std::memory_order_acquire);
+    while (state & kCountMask) {
+        // Flag the count, so "done" wakes us up once it reaches zero
+        if (!(state & kWaitersFlag) &&
+            !m_state.compare_exchange_weak(state, state | kWaitersFlag))
+            continue;
+        futexWait(m_state, state | kWaitersFlag);
+        state = m_state.load(std::memory_order_acquire);
+    }
+}
+
+bool WaitGroup::trywait() const {
+    return (m_state.load(std::memory_order_acquire) & kCountMask) == 0;
+}
+
+unsigned int WaitGroup::count() const {
+    return m_state.load(std::memory_order_relaxed) & kCountMask;
+}
+
+void WaitGroup::addAsyncWaiter(std::function<void()> post) {
+    {
+        std::lock_guard<std::mutex> lock(m_asyncMtx);
+        uint32_t state = m_state.load();
+        while (state & kCountMask) {
+            // The last "done" sees the flag, and takes the waiter under the
+            // lock
+            if (m_state.compare_exchange_weak(state, state | kAsyncFlag)) {
+                m_async.push_back(std::move(post));
+                return;
+            }
+        }
+    }
+    post();
+}
+
+void WaitGroup::takeAsyncWaiters(std::vector<std::function<void()>>& ready) {
+    std::lock_guard<std::mutex> lock(m_asyncMtx);
+    for (auto&& post : m_async)
+        ready.push_back(std::move(post));
+    m_async.clear();
+    m_state.fetch_and(~kAsyncFlag);
+}
+
+void WaitGroup::returnAsyncWaiters(std::vector<std::function<void()>>& ready) {
+    std::lock_guard<std::mutex> lock(m_asyncMtx);
+    // Older than any registered meanwhile
+    m_async.insert(m_async.begin(), std::make_move_iterator(ready.begin()),
+                   std::make_move_iterator(ready.end()));
+    ready.clear();
+    m_state.fetch_or(kAsyncFlag);
+}
+
+void Barrier::arriveAndWait() {
+    // Read before arriving, since the last thread to arrive bumps it
+    uint32_t phase = m_phase.load(std::memory_order_acquire);
+    if (m_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_numThreads) {
+        // Nobody arrives for the next phase until they see the new one
+        m_arrived.store(0, std::memory_order_relaxed);
+        m_phase.fetch_add(1, std::memory_order_release);
+        futexWakeAll(m_phase);
+        return;
+    }
+    while (m_phase.load(std::memory_order_acquire) == phase)
+        futexWait(m_phase, phase);
+}
+
+}  // namespace cz
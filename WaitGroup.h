@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Coroutine.h"
+#include "Priority.h"
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace cz {
+
+//!
+// Counts outstanding work, and lets threads wait for it to reach zero.
+// "add" and "done" are single atomic operations, and waiters are woken up only
+// once, when the count reaches zero, rather than on every "done".
+//
+//	WaitGroup wg;
+//	wg.add(n);
+//	for (...) workQueue.push([&wg] { ...; wg.done(); });
+//	wg.wait();
+//
+// Once the count reaches zero, the group can be reused, or destroyed as soon
+// as "wait" returns: the decrement to zero is the last access "done" makes to
+// the group.
+class WaitGroup {
+public:
+    explicit WaitGroup(unsigned int count = 0) : m_state(count) {}
+
+    WaitGroup(const WaitGroup&) = delete;
+    WaitGroup& operator=(const WaitGroup&) = delete;
+
+    void add(unsigned int n = 1);
+    void done();
+    // Blocks until the count is zero
+    void wait();
+    // Returns true if the count is zero
+    bool trywait() const;
+    unsigned int count() const;
+
+    // Non-blocking "wait", for handlers executing in a Processor. Once the
+    // count reaches zero, "continuation" is posted to "ex" (a Strand, or a
+    // Processor), with no thread blocked meanwhile.
+    template <typename Executor, typename F>
+    void async_wait(Executor& ex, F continuation) {
+        addAsyncWaiter([&ex, continuation]() mutable {
+            detail::postTo(ex, std::move(continuation));
+        });
+    }
+
+#if CZ_HAS_COROUTINES
+    // "co_await wg.async_wait(ex)"
+    template <typename Executor>
+    AsyncWaitAwaiter<WaitGroup, Executor> async_wait(Executor& ex) {
+        return AsyncWaitAwaiter<WaitGroup, Executor>(*this, ex);
+    }
+#endif
+
+private:
+    void addAsyncWaiter(std::function<void()> post);
+    // Moves the asynchronous waiters to "ready", or back, clearing or setting
+    // their flag
+    void takeAsyncWaiters(std::vector<std::function<void()>>& ready);
+    void returnAsyncWaiters(std::vector<std::function<void()>>& ready);
+
+    // The count, plus flags for sleeping and asynchronous waiters, which are
+    // cleared when the count reaches zero
+    std::atomic<uint32_t> m_state;
+    std::mutex m_asyncMtx;
+    std::vector<std::function<void()>> m_async;
+};
+
+//!
+// Reusable barrier for a fixed number of threads. Each phase completes when
+// all the threads called "arriveAndWait", and wakes them up at once.
+class Barrier {
+public:
+    explicit Barrier(unsigned int numThreads) : m_numThreads(numThreads) {}
+
+    Barrier(const Barrier&) = delete;
+    Barrier& operator=(const Barrier&) = delete;
+
+    void arriveAndWait();
+
+private:
+    const unsigned int m_numThreads;
+    std::atomic<uint32_t> m_arrived{0};
+    // Bumped when a phase completes. The threads of the phase sleep on it
+    std::atomic<uint32_t> m_phase{0};
+};
+
+}  // namespace cz
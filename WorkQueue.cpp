@@ -0,0 +1,805 @@
+#include "WorkQueue.h"
+#include "PerWorker.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace {
+// How many items each level gets to dequeue per round, when all levels have
+// work queued. Indexed by Priority.
+const int gLevelWeights[kNumPriorities] = {1, 4, 16};
+
+// How many resize events to keep
+const size_t gMaxResizeEvents = 256;
+
+// How many items in a row a worker can take from its LIFO slot, before it
+// gives the shared queues a turn
+const unsigned gMaxLifoRuns = 3;
+
+// How long an item can sit in the LIFO slot of a busy worker, before idle
+// workers take it
+const double gLifoStealMs = 1;
+
+double toMs(WorkQueue::Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+WorkQueue::Clock::duration fromMs(double ms) {
+    return std::chrono::duration_cast<WorkQueue::Clock::duration>(
+        std::chrono::duration<double, std::milli>(ms));
+}
+
+// Handle to query the current thread's CPU time from other threads, or -1 if
+// not supported
+intptr_t openThreadCpuClock() {
+#if defined(_WIN32)
+    HANDLE h = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE,
+                          GetCurrentThreadId());
+    return h ? reinterpret_cast<intptr_t>(h) : -1;
+#elif defined(__linux__)
+    clockid_t id;
+    if (pthread_getcpuclockid(pthread_self(), &id) != 0)
+        return -1;
+    return static_cast<intptr_t>(id);
+#else
+    return -1;
+#endif
+}
+
+void closeThreadCpuClock(intptr_t clock) {
+#if defined(_WIN32)
+    if (clock != -1)
+        CloseHandle(reinterpret_cast<HANDLE>(clock));
+#else
+    (void)clock;
+#endif
+}
+
+// CPU time used by a thread so far, or -1 if not supported
+double threadCpuMs(intptr_t clock) {
+    if (clock == -1)
+        return -1;
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(reinterpret_cast<HANDLE>(clock), &creation, &exit,
+                        &kernel, &user))
+        return -1;
+    auto to100ns = [](const FILETIME& t) {
+        return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+    };
+    return (to100ns(kernel) + to100ns(user)) / 10000.0;
+#elif defined(__linux__)
+    timespec ts;
+    if (clock_gettime(static_cast<clockid_t>(clock), &ts) != 0)
+        return -1;
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#else
+    return -1;
+#endif
+}
+}  // namespace
+
+WorkQueue::WorkQueue() {
+    std::copy(std::begin(gLevelWeights), std::end(gLevelWeights), m_credits);
+}
+
+WorkQueue::~WorkQueue() {
+    if (m_supervisor.joinable()) {
+        stop();
+        joinPool();
+    }
+}
+
+void WorkQueue::pushItem(std::function<void()> w, Priority prio,
+                         Deadline deadline) {
+    // An empty work item is a request to shut down
+    if (!w) {
+        stop();
+        return;
+    }
+    // Items pushed by our own workers go to their LIFO slot
+    Worker* me = Callstack<WorkQueue, Worker>::contains(this);
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_aborting) {
+        // Destroyed once unlocked, since the destructor might push more work
+        m_stats[static_cast<int>(prio)].discarded++;
+    } else if (me && m_lifoEnabled) {
+        demoteLifoLocked(*me);
+        me->lifo = Item{std::move(w), Clock::now(), std::move(deadline)};
+        me->lifoPrio = prio;
+        m_stats[static_cast<int>(prio)].queued++;
+        // Idle workers (or the poller's) need to start checking for stuck
+        // items, in case this worker stays busy
+        if (m_lifoItems++ == 0)
+            wakeForLifoLocked();
+    } else {
+        pushLocked(Item{std::move(w), Clock::now(), std::move(deadline)},
+                   prio);
+    }
+}
+
+void WorkQueue::deferItem(std::function<void()> w, Priority prio) {
+    if (!w) {
+        stop();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (m_aborting)
+        m_stats[static_cast<int>(prio)].discarded++;
+    else
+        pushLocked(Item{std::move(w), Clock::now(), Deadline()}, prio);
+}
+
+void WorkQueue::pushLocked(Item item, Priority prio) {
+    int level = static_cast<int>(prio);
+    if (m_edfEnabled && item.deadline.isSet()) {
+        m_edf[level].push_back(std::move(item));
+        std::push_heap(m_edf[level].begin(), m_edf[level].end(),
+                       LaterDeadline());
+    } else {
+        m_q[level].push(std::move(item));
+    }
+    m_stats[static_cast<int>(prio)].queued++;
+    m_cond.notify_all();
+    // If no worker is waiting for work, the poller's worker needs to stop
+    // waiting for events and pick this up
+    if (m_polling && !m_pollInterrupted && m_idle == 0) {
+        m_pollInterrupted = true;
+        m_poller->interrupt();
+    }
+    if (m_poolStats.blocked)
+        compensateLocked();
+}
+
+bool WorkQueue::emptyLocked() const {
+    for (int i = 0; i < kNumPriorities; i++) {
+        if (!emptyLocked(i))
+            return false;
+    }
+    return true;
+}
+
+bool WorkQueue::emptyLocked(int level) const {
+    return m_q[level].empty() && m_edf[level].empty();
+}
+
+bool WorkQueue::finishedLocked() const {
+    if (!m_stopping)
+        return false;
+    if (m_aborting)
+        return true;
+    // When draining, busy workers (and the poller's handlers) might still
+    // push more work
+    if (!emptyLocked() || m_lifoItems || m_polling)
+        return false;
+    for (const Worker* w : m_workers) {
+        if (w->busy)
+            return false;
+    }
+    return true;
+}
+
+double WorkQueue::oldestWaitMsLocked(Clock::time_point now) const {
+    // For the deadline ordered items, the top of the heap is a good enough
+    // approximation, since it's what the workers are waiting on
+    double res = 0;
+    for (int i = 0; i < kNumPriorities; i++) {
+        if (!m_q[i].empty())
+            res = std::max(res, toMs(now - m_q[i].front().enqueued));
+        if (!m_edf[i].empty())
+            res = std::max(res, toMs(now - m_edf[i].front().enqueued));
+    }
+    return res;
+}
+
+WorkQueue::Item WorkQueue::popLocked() {
+    // Pick the highest priority level that still has credits left in this
+    // round. If no level with work has credits left, start a new round.
+    int level = -1;
+    while (level == -1) {
+        for (int i = kNumPriorities - 1; i >= 0; i--) {
+            if (!emptyLocked(i) && m_credits[i] > 0) {
+                level = i;
+                break;
+            }
+        }
+        if (level == -1)
+            std::copy(std::begin(gLevelWeights), std::end(gLevelWeights),
+                      m_credits);
+    }
+
+    m_credits[level]--;
+    Item item;
+    std::vector<Item>& heap = m_edf[level];
+    std::queue<Item>& q = m_q[level];
+    if (heap.size() && (q.empty() || heap.front().deadline.at <=
+                                         q.front().enqueued + m_noDeadline)) {
+        std::pop_heap(heap.begin(), heap.end(), LaterDeadline());
+        item = std::move(heap.back());
+        heap.pop_back();
+    } else {
+        item = std::move(q.front());
+        q.pop();
+    }
+    dequeuedLocked(level, item);
+    return item;
+}
+
+void WorkQueue::dequeuedLocked(int level, Item& item) {
+    auto now = Clock::now();
+    double delayMs = toMs(now - item.enqueued);
+    LevelStats& stats = m_stats[level];
+    stats.queued--;
+    stats.count++;
+    stats.totalDelayMs += delayMs;
+    stats.maxDelayMs = std::max(stats.maxDelayMs, delayMs);
+
+    if (item.deadline.expired(now)) {
+        stats.expired++;
+        item.fn = std::move(item.deadline.onExpired);
+        if (!item.fn)
+            item.fn = [] {};
+    }
+}
+
+bool WorkQueue::takeLifoLocked(Worker& me, Item& item) {
+    if (!me.lifo.fn) {
+        me.lifoRuns = 0;
+        return false;
+    }
+
+    // Don't let the slot starve the shared queues, or jump ahead of higher
+    // priority work
+    bool higher = false;
+    for (int i = static_cast<int>(me.lifoPrio) + 1; i < kNumPriorities; i++)
+        higher = higher || !emptyLocked(i);
+    if (higher || me.lifoRuns == gMaxLifoRuns) {
+        me.lifoRuns = 0;
+        demoteLifoLocked(me);
+        return false;
+    }
+
+    me.lifoRuns++;
+    item = std::move(me.lifo);
+    me.lifo.fn = nullptr;
+    m_lifoItems--;
+    dequeuedLocked(static_cast<int>(me.lifoPrio), item);
+    return true;
+}
+
+void WorkQueue::demoteLifoLocked(Worker& w) {
+    if (!w.lifo.fn)
+        return;
+    m_lifoItems--;
+    m_stats[static_cast<int>(w.lifoPrio)].queued--;
+    Item item = std::move(w.lifo);
+    w.lifo.fn = nullptr;
+    pushLocked(std::move(item), w.lifoPrio);
+}
+
+void WorkQueue::wakeForLifoLocked() {
+    if (m_idle) {
+        m_cond.notify_one();
+    } else if (m_polling && !m_pollInterrupted) {
+        m_pollInterrupted = true;
+        m_poller->interrupt();
+    }
+}
+
+bool WorkQueue::demoteStaleLifoLocked() {
+    auto now = Clock::now();
+    bool res = false;
+    for (Worker* w : m_workers) {
+        if (w->lifo.fn && toMs(now - w->lifo.enqueued) >= gLifoStealMs) {
+            demoteLifoLocked(*w);
+            res = true;
+        }
+    }
+    return res;
+}
+
+unsigned WorkQueue::numWorkers() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return static_cast<unsigned>(m_workers.size());
+}
+
+void WorkQueue::setLifoSlot(bool enabled) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_lifoEnabled = enabled;
+    if (!enabled) {
+        for (Worker* w : m_workers)
+            demoteLifoLocked(*w);
+    }
+}
+
+void WorkQueue::setDeadlineOrdering(bool enabled, double noDeadlineMs) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    // Items already in the heaps are still picked by their deadline, so they
+    // don't need to be moved back
+    m_edfEnabled = enabled;
+    m_noDeadline = fromMs(noDeadlineMs);
+}
+
+unsigned WorkQueue::acquireIndexLocked() {
+    auto it = std::find(m_usedIndexes.begin(), m_usedIndexes.end(), false);
+    unsigned index = static_cast<unsigned>(it - m_usedIndexes.begin());
+    if (it == m_usedIndexes.end())
+        m_usedIndexes.push_back(true);
+    else
+        *it = true;
+    return index;
+}
+
+void WorkQueue::run() {
+    Worker me;
+    me.pooled = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        me.index = acquireIndexLocked();
+    }
+    runWorker(me);
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_usedIndexes[me.index] = false;
+}
+
+void WorkQueue::runWorker(Worker& me) {
+    Callstack<WorkQueue, Worker>::Context ctx(this, me);
+    WorkerId::Scope workerId(me.index);
+    me.cpuClock = openThreadCpuClock();
+    me.sampleCpuMs = threadCpuMs(me.cpuClock);
+    me.sampleTime = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_workers.push_back(&me);
+    auto wakeUp = [this] {
+        return !emptyLocked() || finishedLocked() ||
+               (m_poller && !m_polling && !m_stopping);
+    };
+    // Untimed waits also need to wake up once there are items in LIFO slots,
+    // to check if they get stuck
+    auto wakeUpOrLifo = [this, &wakeUp] { return wakeUp() || m_lifoItems; };
+
+    while (true) {
+        Item item;
+        if (takeLifoLocked(me, item)) {
+            // Continuation pushed by the previous item
+        } else if (emptyLocked()) {
+            // Take over any items stuck in the slot of a busy worker
+            if (m_lifoItems && demoteStaleLifoLocked())
+                continue;
+
+            if (finishedLocked())
+                break;
+
+            // One of the idle workers waits for the poller's events, and the
+            // others wait for work items. Once stopping, there are no more
+            // polls.
+            if (m_poller && !m_polling && !m_stopping) {
+                pollLocked(me, lock);
+                continue;
+            }
+
+            m_idle++;
+            bool timedOut = false;
+            if (m_lifoItems) {
+                m_cond.wait_for(lock, fromMs(gLifoStealMs), wakeUp);
+            } else if (me.pooled) {
+                timedOut = !m_cond.wait_for(lock, fromMs(m_pool.idleRetireMs),
+                                            wakeUpOrLifo);
+            } else {
+                m_cond.wait(lock, wakeUpOrLifo);
+            }
+            m_idle--;
+
+            if (timedOut && retireLocked(me, lock, true))
+                break;
+            continue;
+        } else {
+            item = popLocked();
+        }
+
+        me.busy = true;
+        me.busySince = Clock::now();
+        lock.unlock();
+        item.fn();
+        lock.lock();
+        me.busy = false;
+        if (m_poolStats.compensating && retireLocked(me, lock, false))
+            break;
+    }
+
+    m_workers.erase(std::find(m_workers.begin(), m_workers.end(), &me));
+    m_exitCond.notify_all();
+    // Wake up the other workers, in case this was the last busy one
+    if (finishedLocked())
+        m_cond.notify_all();
+    // Spares were already removed from the thread count
+    if (me.pooled && !me.spare && --m_poolStats.threads == 0)
+        m_superviseCond.notify_all();
+    closeThreadCpuClock(me.cpuClock);
+}
+
+void WorkQueue::pollLocked(Worker& me, std::unique_lock<std::mutex>& lock) {
+    Poller* poller = m_poller;
+    m_polling = true;
+    m_pollInterrupted = false;
+    // Keep checking for stuck LIFO slot items meanwhile
+    int timeoutMs =
+        m_lifoItems ? static_cast<int>(std::ceil(gLifoStealMs)) : -1;
+    lock.unlock();
+    poller->poll(timeoutMs, me.ready);
+    lock.lock();
+    m_polling = false;
+    m_pollReleased.notify_all();
+    // Let another idle worker take over while we run the handlers
+    m_cond.notify_one();
+    if (me.ready.empty())
+        return;
+
+    me.busy = true;
+    me.busySince = Clock::now();
+    lock.unlock();
+    for (auto&& h : me.ready)
+        h();
+    me.ready.clear();
+    lock.lock();
+    me.busy = false;
+}
+
+void WorkQueue::setPoller(Poller* poller) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    // Wait for the current poller to be released
+    while (m_polling) {
+        if (!m_pollInterrupted) {
+            m_pollInterrupted = true;
+            m_poller->interrupt();
+        }
+        m_pollReleased.wait(lock);
+    }
+    m_poller = poller;
+    m_cond.notify_all();
+}
+
+bool WorkQueue::retireLocked(Worker& me, std::unique_lock<std::mutex>& lock,
+                             bool idleTimeout) {
+    if (!me.pooled)
+        return false;
+
+    // Compensating workers no longer needed become spares, so they can be
+    // woken up to compensate again, instead of creating new threads
+    unsigned unblocked = m_poolStats.threads - m_poolStats.blocked;
+    if (m_poolStats.compensating && unblocked > m_target) {
+        m_poolStats.compensating--;
+        logResizeLocked(ResizeReason::Unblocked, m_poolStats.threads,
+                        m_poolStats.threads - 1);
+        m_poolStats.threads--;
+        if (m_poolStats.threads == 0)
+            m_superviseCond.notify_all();
+
+        demoteLifoLocked(me);
+        // Parked spares don't exit on "stop", so wake up the other workers,
+        // in case this was the last busy one
+        if (finishedLocked())
+            m_cond.notify_all();
+        me.spare = true;
+        m_spares++;
+        bool woken = m_spareCond.wait_for(
+            lock, fromMs(m_pool.idleRetireMs),
+            [this] { return m_spareWakeups || m_poolStopping; });
+        m_spares--;
+        if (woken && !m_poolStopping) {
+            // Whoever woke us already accounted for this worker
+            m_spareWakeups--;
+            me.spare = false;
+            return false;
+        }
+        return true;
+    }
+
+    if (idleTimeout && m_target > m_pool.minThreads) {
+        m_target--;
+        m_poolStats.retired++;
+        logResizeLocked(ResizeReason::Idle, m_poolStats.threads,
+                        m_poolStats.threads - 1);
+        return true;
+    }
+
+    return false;
+}
+
+WorkQueue::BlockingScope::BlockingScope() {
+    auto it = Callstack<WorkQueue, Worker>::begin();
+    if (it != Callstack<WorkQueue, Worker>::end()) {
+        m_q = (*it)->getKey();
+        m_worker = (*it)->getValue();
+        m_q->enterBlocking(*m_worker);
+    }
+}
+
+WorkQueue::BlockingScope::BlockingScope(WorkQueue& q) {
+    m_worker = Callstack<WorkQueue, Worker>::contains(&q);
+    if (m_worker) {
+        m_q = &q;
+        m_q->enterBlocking(*m_worker);
+    }
+}
+
+WorkQueue::BlockingScope::~BlockingScope() {
+    if (m_q)
+        m_q->leaveBlocking(*m_worker);
+}
+
+void WorkQueue::enterBlocking(Worker& w) {
+    if (!w.pooled)
+        return;
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (w.blocking++ == 0) {
+        m_poolStats.blocked++;
+        compensateLocked();
+    }
+}
+
+void WorkQueue::leaveBlocking(Worker& w) {
+    if (!w.pooled)
+        return;
+    // Any excess compensating workers retire once they finish their current
+    // item (see "retireLocked", and "compensateLocked" for how they are
+    // added)
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if (--w.blocking == 0)
+        m_poolStats.blocked--;
+}
+
+void WorkQueue::compensateLocked() {
+    // Nothing to do if idle workers can pick up the queued work
+    if (m_idle || m_polling || emptyLocked() || m_poolStopping)
+        return;
+    if (m_poolStats.threads - m_poolStats.blocked >= m_target)
+        return;
+
+    if (m_spares > m_spareWakeups) {
+        m_spareWakeups++;
+        addThreadLocked(ResizeReason::Blocking);
+        m_spareCond.notify_one();
+    } else if (m_liveThreads < m_pool.maxThreads) {
+        spawnLocked(ResizeReason::Blocking);
+    }
+}
+
+size_t WorkQueue::stop(StopMode mode) {
+    // Discarded items are destroyed once unlocked, since their destructors
+    // might push more work
+    std::queue<Item> q[kNumPriorities];
+    std::vector<Item> edf[kNumPriorities];
+    std::vector<Item> lifo;
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    size_t discarded = 0;
+    if (mode == StopMode::Abort) {
+        m_aborting = true;
+        for (int i = 0; i < kNumPriorities; i++) {
+            q[i].swap(m_q[i]);
+            edf[i].swap(m_edf[i]);
+            size_t count = q[i].size() + edf[i].size();
+            m_stats[i].queued -= count;
+            m_stats[i].discarded += count;
+            discarded += count;
+        }
+        for (Worker* w : m_workers) {
+            if (!w->lifo.fn)
+                continue;
+            LevelStats& stats = m_stats[static_cast<int>(w->lifoPrio)];
+            stats.queued--;
+            stats.discarded++;
+            discarded++;
+            m_lifoItems--;
+            lifo.push_back(std::move(w->lifo));
+            w->lifo.fn = nullptr;
+        }
+    }
+
+    // Wake up all the workers at once
+    m_stopping = true;
+    m_cond.notify_all();
+    if (m_polling && !m_pollInterrupted) {
+        m_pollInterrupted = true;
+        m_poller->interrupt();
+    }
+    return discarded;
+}
+
+bool WorkQueue::stopAndJoin(StopMode mode, double timeoutMs) {
+    stop(mode);
+    {
+        // Parked spares only exit once "joinPool" wakes them up
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (!m_exitCond.wait_for(lock, fromMs(timeoutMs), [this] {
+                return m_workers.size() == m_spares;
+            }))
+            return false;
+    }
+    joinPool();
+    return true;
+}
+
+void WorkQueue::startPool(PoolOptions opts) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_pool = std::move(opts);
+    m_pool.maxThreads = std::max(m_pool.maxThreads, 1u);
+    m_pool.minThreads =
+        std::max(std::min(m_pool.minThreads, m_pool.maxThreads), 1u);
+    m_poolStart = Clock::now();
+    m_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned i = 0; i < m_pool.minThreads; i++)
+        spawnLocked(ResizeReason::Start);
+    m_supervisor = std::thread([this] { superviseMain(); });
+}
+
+void WorkQueue::spawnLocked(ResizeReason reason) {
+    unsigned index = acquireIndexLocked();
+    m_poolThreads.emplace_back();
+    PoolThread* pt = &m_poolThreads.back();
+    m_liveThreads++;
+    addThreadLocked(reason);
+
+    pt->th = std::thread([this, index, pt] {
+        Worker me;
+        me.index = index;
+        me.pooled = true;
+        std::function<void()> loop = [this, &me] { runWorker(me); };
+        if (m_pool.workerEntry)
+            m_pool.workerEntry(index, loop);
+        else
+            loop();
+
+        // Only release the index once the thread is done with it, since
+        // "workerEntry" might use it after the loop. The thread stops counting
+        // towards maxThreads at the same time, so new threads can't get an
+        // index above it.
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_usedIndexes[index] = false;
+        m_liveThreads--;
+        pt->exited = true;
+    });
+}
+
+void WorkQueue::addThreadLocked(ResizeReason reason) {
+    unsigned from = m_poolStats.threads++;
+    m_poolStats.peakThreads =
+        std::max(m_poolStats.peakThreads, m_poolStats.threads);
+    if (reason == ResizeReason::Blocking) {
+        m_poolStats.compensating++;
+        m_poolStats.compensated++;
+    } else {
+        m_target++;
+        if (reason == ResizeReason::Starved)
+            m_poolStats.grown++;
+    }
+    logResizeLocked(reason, from, from + 1);
+}
+
+void WorkQueue::logResizeLocked(ResizeReason reason, unsigned from,
+                                unsigned to) {
+    auto now = Clock::now();
+    ResizeEvent evt{toMs(now - m_poolStart), reason, from, to,
+                    oldestWaitMsLocked(now)};
+    m_resizeEvents.push_back(evt);
+    if (m_resizeEvents.size() > gMaxResizeEvents)
+        m_resizeEvents.pop_front();
+    if (m_pool.onResize)
+        m_pool.onResize(evt);
+}
+
+void WorkQueue::superviseMain() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    double prevWaitMs = 0;
+    auto lastSample = Clock::now();
+    while (!m_poolStopping) {
+        m_superviseCond.wait_for(lock, fromMs(m_pool.sampleMs));
+        if (m_poolStopping)
+            break;
+
+        // Join any retired threads
+        std::list<PoolThread> exited;
+        for (auto it = m_poolThreads.begin(); it != m_poolThreads.end();) {
+            auto next = std::next(it);
+            if (it->exited)
+                exited.splice(exited.end(), m_poolThreads, it);
+            it = next;
+        }
+        if (exited.size()) {
+            lock.unlock();
+            for (auto&& t : exited)
+                t.th.join();
+            lock.lock();
+        }
+
+        // Count the workers that were busy during the whole sample, but barely
+        // used the CPU, since those are blocked (e.g: waiting for a lock).
+        // If CPU time is not available, fall back to workers executing the
+        // same item for too long.
+        // Workers in a BlockingScope are not counted, since those are already
+        // compensated for.
+        auto now = Clock::now();
+        unsigned blocked = 0;
+        double poolCpuMs = 0;
+        for (Worker* w : m_workers) {
+            double cpuMs = threadCpuMs(w->cpuClock);
+            double wallMs = toMs(now - w->sampleTime);
+            if (w->busy && !w->blocking && w->busySince <= w->sampleTime) {
+                if (cpuMs < 0) {
+                    if (toMs(now - w->busySince) > m_pool.growWaitMs)
+                        blocked++;
+                } else if (cpuMs - w->sampleCpuMs <
+                           wallMs * m_pool.blockedCpuRatio) {
+                    blocked++;
+                }
+            }
+            if (cpuMs >= 0 && w->sampleCpuMs >= 0)
+                poolCpuMs += cpuMs - w->sampleCpuMs;
+            w->sampleCpuMs = cpuMs;
+            w->sampleTime = now;
+        }
+        // The pool is using (nearly) all the CPUs
+        bool saturated = poolCpuMs >= toMs(now - lastSample) * m_cpus * 0.9;
+        lastSample = now;
+
+        double waitMs = oldestWaitMsLocked(now);
+        bool rising = waitMs >= prevWaitMs;
+        prevWaitMs = waitMs;
+        if (emptyLocked() || m_idle || m_polling ||
+            m_liveThreads >= m_pool.maxThreads)
+            continue;
+
+        // Work is waiting and no worker is free to pick it up. Only add a
+        // worker if some of the existing ones are blocked, since adding
+        // threads to a pool that is simply saturated with CPU work doesn't
+        // help. Workers on an oversubscribed machine also get little CPU
+        // time, so don't add any if the pool already uses all CPUs.
+        if (waitMs > m_pool.growWaitMs && rising && blocked && !saturated)
+            spawnLocked(ResizeReason::Starved);
+    }
+}
+
+void WorkQueue::joinPool() {
+    {
+        // Workers can still be added while the queue drains, so only stop
+        // managing the pool once they all exit
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_superviseCond.wait(lock, [this] { return m_poolStats.threads == 0; });
+        m_poolStopping = true;
+        m_superviseCond.notify_all();
+        m_spareCond.notify_all();
+    }
+    if (m_supervisor.joinable())
+        m_supervisor.join();
+
+    // No more threads can be created at this point
+    std::list<PoolThread> threads;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        threads.swap(m_poolThreads);
+    }
+    for (auto&& t : threads)
+        t.th.join();
+}
+
+WorkQueue::Stats WorkQueue::stats() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    Stats res;
+    std::copy(std::begin(m_stats), std::end(m_stats), res.levels);
+    res.pool = m_poolStats;
+    return res;
+}
+
+std::vector<WorkQueue::ResizeEvent> WorkQueue::resizeEvents() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return std::vector<ResizeEvent>(m_resizeEvents.begin(),
+                                    m_resizeEvents.end());
+}
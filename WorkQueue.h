@@ -2,56 +2,432 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <deque>
+#include <list>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <stdint.h>
+#include "CacheLine.h"
 #include "Callstack.h"
+#include "Continuation.h"
+#include "Deadline.h"
+#include "Priority.h"
 
 // Really simple Multiple producer / Multiple consumer work queue
+//
+// Work items have a priority (see Priority.h). Each priority level has its own
+// FIFO queue, and workers pick between the levels with a weighted round-robin,
+// so higher priorities get most of the workers, but lower priorities still get
+// a share, and can't be starved by a flood of higher priority items.
+//
+// Workers are either threads calling "run", or threads the queue creates
+// itself, by calling "startPool". In the latter case, the queue adds workers
+// when work is waiting too long while the existing workers are stalled, and
+// retires workers that are idle for too long. Handlers can also explicitly
+// mark blocking regions with a BlockingScope, for which the pool compensates
+// immediately.
+//
+// Items pushed from a worker's handler go into that worker's LIFO slot, and the
+// worker executes them next, while the data they use is still in its cache.
+// Pushing again demotes the previous item to the shared queues, as does
+// running too many items in a row from the slot, or the shared queues having
+// higher priority work. Items stuck in the slot of a busy worker are taken
+// over by idle workers after a short delay.
+//
+// Items can have a Deadline. Workers skip the items that expired while queued
+// (counted in the stats), executing their "onExpired" callback instead. The
+// queue can also order each level by earliest deadline first (see
+// "setDeadlineOrdering").
+//
+// A Poller (e.g: an epoll reactor, see Reactor.h) can be attached, in which
+// case one of the idle workers waits for the poller's events instead of work
+// items, and the poller is interrupted when work is pushed while no other
+// worker is idle.
 class WorkQueue {
+private:
+    struct Worker;
+
 public:
-    // Add a new work item
+    using Clock = std::chrono::steady_clock;
+
+    // Queueing statistics for a single priority level
+    struct LevelStats {
+        // Number of items currently queued
+        size_t queued = 0;
+        // Number of items dequeued so far
+        uint64_t count = 0;
+        // Number of dequeued items skipped due to their deadline
+        uint64_t expired = 0;
+        // Number of items discarded by "stop(StopMode::Abort)"
+        uint64_t discarded = 0;
+        // Total and maximum time the dequeued items spent in the queue
+        double totalDelayMs = 0;
+        double maxDelayMs = 0;
+
+        double avgDelayMs() const {
+            return count ? totalDelayMs / count : 0;
+        }
+    };
+
+    struct PoolStats {
+        // Current and maximum number of pool workers
+        unsigned threads = 0;
+        unsigned peakThreads = 0;
+        // Number of workers added/retired due to the load
+        uint64_t grown = 0;
+        uint64_t retired = 0;
+        // Pool workers currently inside a BlockingScope
+        unsigned blocked = 0;
+        // Current and total number of workers added to compensate for
+        // blocked workers
+        unsigned compensating = 0;
+        uint64_t compensated = 0;
+    };
+
+    struct Stats {
+        LevelStats levels[kNumPriorities];
+        PoolStats pool;
+        const LevelStats& operator[](Priority prio) const {
+            return levels[static_cast<int>(prio)];
+        }
+    };
+
+    enum class ResizeReason {
+        // Worker created by "startPool"
+        Start,
+        // Work was waiting too long while the workers were stalled
+        Starved,
+        // Worker was idle for too long
+        Idle,
+        // Worker added to compensate for a worker in a BlockingScope
+        Blocking,
+        // Compensating worker no longer needed
+        Unblocked
+    };
+
+    enum class StopMode {
+        // Execute all the queued work items first
+        Drain,
+        // Discard the queued work items
+        Abort
+    };
+
+    // Logged for every decision to change the number of pool workers
+    struct ResizeEvent {
+        // Time since "startPool"
+        double timeMs;
+        ResizeReason reason;
+        unsigned fromThreads;
+        unsigned toThreads;
+        // How long the oldest queued item was waiting at the time
+        double oldestWaitMs;
+    };
+
+    struct PoolOptions {
+        // At least 1
+        unsigned minThreads = 1;
+        // Also limits compensating workers
+        unsigned maxThreads = 64;
+        // A worker is added if the oldest queued item waited longer than this
+        // (and the wait is rising), no worker is idle, and some of the
+        // workers are blocked.
+        double growWaitMs = 10;
+        // A worker is considered blocked if it was busy for a whole sample,
+        // but its thread used less than this fraction of CPU time.
+        double blockedCpuRatio = 0.25;
+        // Workers idle for longer than this are retired, down to minThreads
+        double idleRetireMs = 1000;
+        // How often the queue is checked for starvation
+        double sampleMs = 5;
+        // Optional. Called in every new worker thread, and it must call "run"
+        // to execute the worker loop. Allows per thread setup.
+        // If no threads call WorkQueue::run, "index" is below maxThreads.
+        std::function<void(unsigned index, const std::function<void()>& run)>
+            workerEntry;
+        // Optional. Called (while the queue is locked) for every resize
+        std::function<void(const ResizeEvent&)> onResize;
+    };
+
+    // Marks a blocking region (e.g: waiting for a lock, or blocking I/O) in a
+    // handler, for as long as the object exists.
+    // In pool mode, if blocked workers bring the number of unblocked workers
+    // below the pool's target while there is work queued, the queue creates
+    // compensating workers, and retires them once no longer needed.
+    // Does nothing if not created from a worker.
+    class BlockingScope {
+    public:
+        // Uses the WorkQueue whose worker is executing in the current thread
+        BlockingScope();
+        explicit BlockingScope(WorkQueue& q);
+        ~BlockingScope();
+        BlockingScope(const BlockingScope&) = delete;
+        BlockingScope& operator=(const BlockingScope&) = delete;
+
+    private:
+        WorkQueue* m_q = nullptr;
+        Worker* m_worker = nullptr;
+    };
+
+    // Source of events idle workers can wait for
+    class Poller {
+    public:
+        virtual ~Poller() {}
+        // Waits up to "timeoutMs" (or indefinitely if -1) for events, or until
+        // "interrupt" is called, and adds the handlers to execute to "ready".
+        virtual void poll(int timeoutMs,
+                          std::vector<std::function<void()>>& ready) = 0;
+        // Makes a "poll" call in progress return as soon as possible. Can be
+        // called before "poll", in which case "poll" returns immediately.
+        virtual void interrupt() = 0;
+    };
+
+    WorkQueue();
+    ~WorkQueue();
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    // Add a new work item.
+    // If it returns a Continuation, the rest of its work is deferred (see
+    // "defer") once it returns.
+    // Pushing an empty work item is the same as calling "stop".
     template <typename F>
-    void push(F w) {
-        std::lock_guard<std::mutex> lock(m_mtx);
-        m_q.push(std::move(w));
-        m_cond.notify_all();
+    void push(F w, Priority prio = Priority::Normal) {
+        pushItem(wrap(std::move(w), prio, detail::returnsContinuation<F>()),
+                 prio, Deadline());
     }
 
-    // Continuously waits for and executes any work items, until "stop" is
-    // called
-    void run() {
-        Callstack<WorkQueue>::Context ctx(this);
-        while (true) {
-            std::function<void()> w;
-            {
-                std::unique_lock<std::mutex> lock(m_mtx);
-                m_cond.wait(lock, [this] { return !m_q.empty(); });
-                w = std::move(m_q.front());
-                m_q.pop();
-            }
-
-            if (w) {
-                w();
-            } else {
-                // An empty work item means we are shutting down, so enqueue
-                // another empty work item. This will in turn shut down another
-                // thread that is executing "run"
-                push(nullptr);
-                return;
-            }
-        };
+    // Add a new work item, which is skipped if it's not picked up by the
+    // deadline
+    template <typename F>
+    void push(F w, Deadline deadline, Priority prio = Priority::Normal) {
+        pushItem(wrap(std::move(w), prio, detail::returnsContinuation<F>()),
+                 prio, std::move(deadline));
     }
 
-    // Causes any calls to "run" to exit.
-    void stop() {
-        push(nullptr);
+    // Add a new work item at the back of the queue, even if called from a
+    // worker (bypassing its LIFO slot), so anything already queued with the
+    // same priority executes first.
+    template <typename F>
+    void defer(F w, Priority prio = Priority::Normal) {
+        deferItem(wrap(std::move(w), prio, detail::returnsContinuation<F>()),
+                  prio);
     }
 
+    // Continuously waits for and executes any work items, until "stop" is
+    // called
+    void run();
+
+    // Starts the queue's own pool of workers, which is resized according to
+    // the load, within the specified bounds.
+    void startPool(PoolOptions opts);
+
+    // Causes any calls to "run" (and the pool workers) to exit.
+    // With Drain, workers exit once there is nothing left to execute and no
+    // worker is busy, since busy workers might push more items. With Abort,
+    // workers exit once they finish their current item, and any queued items
+    // (or pushed afterwards) are discarded, which leaves strands with a
+    // discarded run stuck.
+    // Returns the number of items discarded.
+    size_t stop(StopMode mode = StopMode::Drain);
+
+    // Stops the queue, and waits up to "timeoutMs" for the workers to exit,
+    // joining the pool threads. Returns false on timeout, in which case it
+    // can be called again.
+    // Must not be called from a worker.
+    bool stopAndJoin(StopMode mode, double timeoutMs);
+
+    // Waits for the pool workers to exit. Call "stop" first.
+    // Must not be called from a worker.
+    void joinPool();
+
     // Tells if "run" is executing in the current thread
     bool canDispatch() {
-        return Callstack<WorkQueue>::contains(this) != nullptr;
+        return Callstack<WorkQueue, Worker>::contains(this) != nullptr;
+    }
+
+    // Index of the worker executing in the current thread, or -1 if not
+    // called from a worker.
+    // Indexes are in the [0, number of workers) range, and reused when
+    // workers exit. WorkerId::current() returns the same index, without
+    // checking which queue the worker belongs to (see PerWorker.h).
+    int workerIndex() {
+        Worker* w = Callstack<WorkQueue, Worker>::contains(this);
+        return w ? static_cast<int>(w->index) : -1;
     }
 
+    // Number of workers currently executing (threads calling "run", and pool
+    // workers)
+    unsigned numWorkers() const;
+
+    // Sets the poller idle workers wait for, or nullptr for none.
+    // Waits for the previous poller to be released by the workers.
+    void setPoller(Poller* poller);
+
+    // Enables/disables the workers' LIFO slots. Enabled by default.
+    void setLifoSlot(bool enabled);
+
+    // If enabled, items with a deadline are executed in earliest deadline
+    // first order within their priority level. Items without one (e.g: strand
+    // runs) are ordered as if their deadline was "noDeadlineMs" after they
+    // were queued, so a constant stream of items with deadlines can't starve
+    // them. Disabled by default, meaning FIFO order.
+    void setDeadlineOrdering(bool enabled, double noDeadlineMs = 100);
+
+    // Snapshot of the queueing statistics
+    Stats stats() const;
+
+    // The most recent pool resize decisions
+    std::vector<ResizeEvent> resizeEvents() const;
+
 private:
+    struct Item {
+        std::function<void()> fn;
+        Clock::time_point enqueued;
+        Deadline deadline;
+    };
+
+    // Heap order for the deadline ordered items, so the earliest is on top
+    struct LaterDeadline {
+        bool operator()(const Item& a, const Item& b) const {
+            if (a.deadline.at != b.deadline.at)
+                return a.deadline.at > b.deadline.at;
+            return a.enqueued > b.enqueued;
+        }
+    };
+
+    struct Worker {
+        unsigned index;
+        // Created by the pool (as opposed to a thread calling "run")
+        bool pooled;
+        bool busy = false;
+        // BlockingScope nesting level
+        unsigned blocking = 0;
+        // Parked compensating worker (see "retireLocked")
+        bool spare = false;
+        // Handlers returned by the poller
+        std::vector<std::function<void()>> ready;
+        // Item pushed by this worker's handlers, to execute next, and how
+        // many items in a row were taken from the slot
+        Item lifo;
+        Priority lifoPrio = Priority::Normal;
+        unsigned lifoRuns = 0;
+        Clock::time_point busySince;
+        // Handle to query the thread's CPU time, and the values at the last
+        // starvation check
+        intptr_t cpuClock;
+        double sampleCpuMs = 0;
+        Clock::time_point sampleTime;
+    };
+
+    struct PoolThread {
+        std::thread th;
+        bool exited = false;
+    };
+
+    template <typename F>
+    std::function<void()> wrap(F w, Priority prio, std::true_type) {
+        return [this, w, prio]() mutable {
+            Continuation next = w();
+            if (next)
+                defer(std::move(next), prio);
+        };
+    }
+
+    template <typename F>
+    std::function<void()> wrap(F w, Priority, std::false_type) {
+        return std::function<void()>(std::move(w));
+    }
+
+    void pushItem(std::function<void()> w, Priority prio, Deadline deadline);
+    void deferItem(std::function<void()> w, Priority prio);
+    void pushLocked(Item item, Priority prio);
+    // Picks the next item to execute. Assumes m_mtx is locked and there is at
+    // least one queued item
+    Item popLocked();
+    // Updates the stats for a dequeued item. If it expired, it replaces the
+    // item's handler with its "onExpired" callback.
+    void dequeuedLocked(int level, Item& item);
+    bool takeLifoLocked(Worker& me, Item& item);
+    // Moves the item in the worker's LIFO slot to the shared queues
+    void demoteLifoLocked(Worker& w);
+    // Wakes up a worker to watch for stuck items, once the first item is put
+    // in a LIFO slot
+    void wakeForLifoLocked();
+    // Demotes the LIFO slot items that were waiting for too long
+    bool demoteStaleLifoLocked();
+    bool emptyLocked() const;
+    bool emptyLocked(int level) const;
+    // Whether the workers should exit after "stop"
+    bool finishedLocked() const;
+    double oldestWaitMsLocked(Clock::time_point now) const;
+    unsigned acquireIndexLocked();
+    void runWorker(Worker& me);
+    // Waits for the poller's events, and runs their handlers
+    void pollLocked(Worker& me, std::unique_lock<std::mutex>& lock);
+    // Checks if the current pool worker should exit, due to being idle for
+    // too long, or not being needed to compensate for blocked workers
+    bool retireLocked(Worker& me, std::unique_lock<std::mutex>& lock,
+                      bool idleTimeout);
+    void enterBlocking(Worker& w);
+    void leaveBlocking(Worker& w);
+    void compensateLocked();
+    void spawnLocked(ResizeReason reason);
+    void addThreadLocked(ResizeReason reason);
+    void logResizeLocked(ResizeReason reason, unsigned from, unsigned to);
+    void superviseMain();
+
+    // Woken up workers write to the condition variable's internal state
+    // before they get the mutex, so it's kept in a different cache line than
+    // the mutex and the queues, which the lock holder is writing meanwhile
     std::condition_variable m_cond;
-    std::mutex m_mtx;
-    std::queue<std::function<void()>> m_q;
+    alignas(kCacheLineSize) mutable std::mutex m_mtx;
+    std::queue<Item> m_q[kNumPriorities];
+    // Items with a deadline, when ordering by deadline. Heaps ordered with
+    // LaterDeadline. The top of the heap competes with the front of m_q, which
+    // counts as having a deadline m_noDeadline after it was queued.
+    std::vector<Item> m_edf[kNumPriorities];
+    bool m_edfEnabled = false;
+    Clock::duration m_noDeadline = std::chrono::milliseconds(100);
+    // Weighted round-robin credits left for each level in the current round
+    int m_credits[kNumPriorities];
+    LevelStats m_stats[kNumPriorities];
+
+    std::vector<Worker*> m_workers;
+    std::vector<bool> m_usedIndexes;
+    unsigned m_idle = 0;
+    // Notified when a worker exits
+    std::condition_variable m_exitCond;
+    bool m_stopping = false;
+    bool m_aborting = false;
+    bool m_lifoEnabled = true;
+    // Number of workers with an item in their LIFO slot
+    unsigned m_lifoItems = 0;
+
+    Poller* m_poller = nullptr;
+    // A worker is waiting in the poller, and if it was interrupted
+    bool m_polling = false;
+    bool m_pollInterrupted = false;
+    std::condition_variable m_pollReleased;
+
+    // Pool mode
+    PoolOptions m_pool;
+    PoolStats m_poolStats;
+    // Number of pool workers the pool wants, not counting compensating workers
+    unsigned m_target = 0;
+    // Parked compensating workers, and how many of those were told to resume
+    unsigned m_spares = 0;
+    unsigned m_spareWakeups = 0;
+    std::condition_variable m_spareCond;
+    std::list<PoolThread> m_poolThreads;
+    // Number of pool threads holding a worker index, including spares and
+    // exiting threads. Limited to maxThreads.
+    unsigned m_liveThreads = 0;
+    std::thread m_supervisor;
+    unsigned m_cpus = 1;
+    std::condition_variable m_superviseCond;
+    bool m_poolStopping = false;
+    Clock::time_point m_poolStart;
+    std::deque<ResizeEvent> m_resizeEvents;
 };
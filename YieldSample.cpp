@@ -0,0 +1,129 @@
+#include "Strand.h"
+#include "WorkQueue.h"
+#include "Coroutine.h"
+#include "Semaphore.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kNumThreads = 2;
+// Batch jobs, as many as workers, so they can hog all of them
+const int kNumJobs = kNumThreads;
+const int kChunks = 100;
+const unsigned kChunkMs = 1;
+// Short handlers, posted to their own strands while the jobs run
+const int kNumShort = 4;
+const double kTickMs = 2;
+
+enum class Mode { Monolithic, Continuation, Coroutine };
+
+const char* toString(Mode mode) {
+    switch (mode) {
+    case Mode::Monolithic: return "Monolithic";
+    case Mode::Continuation: return "Continuation";
+    case Mode::Coroutine: return "Coroutine";
+    }
+    return "";
+}
+
+struct BatchJob {
+    explicit BatchJob(WorkQueue& wq) : strand(wq) {}
+
+    // Processes a chunk. Returns true when finished
+    bool step() {
+        spinner.spinMs(kChunkMs);
+        if (++done != kChunks)
+            return false;
+        finished->notify();
+        return true;
+    }
+
+    Continuation next() {
+        if (step())
+            return {};
+        return [this] { return next(); };
+    }
+
+    Strand<WorkQueue> strand;
+    Spinner spinner;
+    int done = 0;
+    cz::Semaphore* finished = nullptr;
+};
+
+#if CZ_HAS_COROUTINES
+Job processChunks(BatchJob* job) {
+    while (!job->step())
+        co_await yield(job->strand);
+}
+#endif
+
+void run(Mode mode) {
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    std::vector<std::unique_ptr<Strand<WorkQueue>>> shortStrands;
+    WorkQueue workQueue;
+    std::vector<std::thread> workerThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        workerThreads.push_back(std::thread([&workQueue] { workQueue.run(); }));
+    for (int i = 0; i < kNumShort; i++)
+        shortStrands.push_back(std::make_unique<Strand<WorkQueue>>(workQueue));
+
+    cz::Semaphore finished;
+    auto start = nowMs();
+    for (int i = 0; i < kNumJobs; i++) {
+        jobs.push_back(std::make_unique<BatchJob>(workQueue));
+        BatchJob* job = jobs.back().get();
+        job->finished = &finished;
+        switch (mode) {
+        case Mode::Monolithic:
+            job->strand.post([job] {
+                while (!job->step()) {
+                }
+            });
+            break;
+        case Mode::Continuation:
+            job->strand.post([job] { return job->next(); });
+            break;
+        case Mode::Coroutine:
+#if CZ_HAS_COROUTINES
+            job->strand.post([job] { processChunks(job); });
+#endif
+            break;
+        }
+    }
+
+    // Short handlers keep coming while the jobs run
+    Ticker<Strand<WorkQueue>> ticker(shortStrands, kTickMs);
+
+    for (int i = 0; i < kNumJobs; i++)
+        finished.wait();
+    auto elapsed = nowMs() - start;
+    ticker.stop();
+
+    printf("%-12s: jobs took %8.2fms, %4d short handlers, latency avg=%7.3fms "
+           "max=%7.3fms\n",
+           toString(mode), elapsed, ticker.latencies.count,
+           ticker.latencies.avg(), ticker.latencies.max);
+
+    workQueue.stop();
+    for (auto&& t : workerThreads)
+        t.join();
+}
+
+}  // namespace
+
+void yieldSample() {
+    printf("%d threads, %d jobs of %d chunks of %ums, short handlers every "
+           "%.1fms\n",
+           kNumThreads, kNumJobs, kChunks, kChunkMs, kTickMs);
+    run(Mode::Monolithic);
+    run(Mode::Continuation);
+#if CZ_HAS_COROUTINES
+    run(Mode::Coroutine);
+#else
+    printf("%-12s: not supported by the compiler\n", toString(Mode::Coroutine));
+#endif
+}